@@ -1,7 +1,12 @@
 #include <stdio.h>
-#include <stdlib.h>  // For rand(), srand()
-#include <time.h>    // For time()
+#include <stdlib.h>  // For rand_r()
 #include "neuron.h"  // Include the header file
+#ifdef _OPENMP
+#include <omp.h>
+// Every thread traces in its own ring buffer
+#define traceCore() omp_get_thread_num()
+#endif
+#include "../../Manuel/snnTrace.h"  // Leveled tracing, see SNN_TRACE_LEVEL
 
 void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer) {
     if (n->potential >= n->threshold) {
@@ -11,15 +16,21 @@ void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer) {
     } else {
         n->spiked = false;
     }
-    printf("Neuron -> %d, potential: %.2f, threshold: %.2f, spiked: %d\n",
+    traceNeuron(traceNow.step, traceNow.layer, numberNeuron, (int32_t)(n->potential * 65536.0), n->spiked,
+           "Neuron -> %d, potential: %.2f, threshold: %.2f, spiked: %d\n",
            numberNeuron, n->potential, n->threshold, n->spiked);
 }
 
-void initializeWeights(int weights[][16], int rows, int columns) {
-    srand(time(NULL));
+// The rows are filled in parallel, every row by its own generator seeded from the seed of the layer
+// and the row index, so the weights don't depend on the number of threads.
+void initializeWeights(int* weights, int rows, int columns, unsigned seed) {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
     for (int i = 0; i < rows; i++) {
+        unsigned state = seed * 2654435761u + (unsigned)i;
         for (int j = 0; j < columns; j++) {
-            weights[i][j] = (rand() % 11) - 5;
+            weights[(size_t)i * columns + j] = (rand_r(&state) % 11) - 5;
         }
     }
 }
@@ -34,13 +45,21 @@ void initilizeNeuron(Neuron* n, int num_neuron, double threshold, double resetVa
     }
 }
 
-void simulate(Neuron* neurons, int num_neurons, int num_inputs, int weights[][num_inputs], int* input, int* inputNextLayer) {
-    for (int i = 0; i < num_neurons; i++) {
-        for (int j = 0; j < num_inputs; j++) {
-            if (input[j] == 1) {
-                neurons[i].potential += weights[i][j];
+// A neuron only reads its weights and the input of the layer, and writes its own output, so the
+// neurons are split among the threads of the team by the orphaned omp for, whose implicit barrier
+// ends the layer. Outside of a parallel region, or without OpenMP, the loop is serial.
+void simulate(Layer* layer) {
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for (int i = 0; i < layer->num_neurons; i++) {
+        Neuron* neuron = &layer->neurons[i];
+        const int* weights = layer->weights + (size_t)i * layer->num_inputs;
+        for (int j = 0; j < layer->num_inputs; j++) {
+            if (layer->input[j] == 1) {
+                neuron->potential += weights[j];
             }
-            update_neuron(&neurons[i], i, inputNextLayer);
+            update_neuron(neuron, i, layer->output);
         }
     }
 }
@@ -52,119 +71,80 @@ void init_output(int* input_to_the_Layer, int num_neuron_on_the_Level) {
 }
 
 void verbose_output_of_layer(int num_neurono_of_the_Level, int* input8thLayer, int t) {
+#if SNN_TRACE_LEVEL < TRACE_LAYER
+    (void)input8thLayer;
+    (void)t;
+#endif
     for (int j = 0; j < num_neurono_of_the_Level; j++) {
-        printf("Output from neuron %d: %d, timestep: %d\n", j, input8thLayer[j], t);
+        traceLayer("Output from neuron %d: %d, timestep: %d\n", j, input8thLayer[j], t);
     }
 }
 
 
 
 
-int main(int argc, char*argv[]){
-
-    //Definition of the two neurla levels
-    Neuron firstLevel[num_neuronFirstLevel];
-    Neuron secondLevel[num_neuronSecondLevel];
-    Neuron neuronsLvl3[num_neuron3rdLevel];
-    Neuron neuronsLvl4[num_neuron4thLevel];
-    Neuron neuronsLvl5[num_neuron5thLevel];
-    Neuron neuronsLvl6[num_neuron6thLevel];
-    Neuron neuronsLvl7[num_neuron7thLevel];
-
-
-
-
-    // Define weight matrices according to the defined sizes
-    int weightsInputsToFirst[num_neuronFirstLevel][num_neuronFirstLevel];
-    int weightsFirstToSecond[num_neuronSecondLevel][num_neuronFirstLevel];
-    int weightsSecondToThird[num_neuron3rdLevel][num_neuronSecondLevel];
-    int weightsThirdToFourth[num_neuron4thLevel][num_neuron3rdLevel];
-    int weightsFourthToFifth[num_neuron5thLevel][num_neuron4thLevel];
-    int weightsFifthToSixth[num_neuron6thLevel][num_neuron5thLevel];
-    int weightsSixthToSeventh[num_neuron7thLevel][num_neuron6thLevel];
-
-    // Initialize weight matrices
-    initializeWeights(weightsInputsToFirst, num_neuronSecondLevel, num_neuronFirstLevel);
-    initializeWeights(weightsFirstToSecond, num_neuronSecondLevel, num_neuronFirstLevel);
-    initializeWeights(weightsSecondToThird, num_neuron3rdLevel, num_neuronSecondLevel);
-    initializeWeights(weightsThirdToFourth, num_neuron4thLevel, num_neuron3rdLevel);
-    initializeWeights(weightsFourthToFifth, num_neuron5thLevel, num_neuron4thLevel);
-    initializeWeights(weightsFifthToSixth, num_neuron6thLevel, num_neuron5thLevel);
-    initializeWeights(weightsSixthToSeventh, num_neuron7thLevel, num_neuron6thLevel);
-
-    ///weight that connect primary inputs with first level neurons. Each row define connection to a neuron
-   /*
-   / int weightsFirstLevel[num_neuronFirstLevel][4] = {{3, 2, 4, 1},
-                                                {4,5,6,4},
-                                                {3,10,1,-5},
-                                                {4,1,2,-4}};
-    
-    ///weight that connect outputs of the first layer with second level neurons. Each row define connection to a neuron
-    int weightsSecondLevel[num_neuronSecondLevel][num_neuronFirstLevel] = {{0, -3, 3, 8},
-                                                                    {0,5,0,0}}; */
-    
-    //definition of vectors that store outputs of each layer of neurons
-    int inputSecondLayer[num_neuronFirstLevel];
-    int inputThirdLayer[num_neuronSecondLevel];
-    int input4thLayer[num_neuron3rdLevel];
-    int input5thLayer[num_neuron4thLevel];
-    int input6thLayer[num_neuron5thLevel];
-    int input7thLayer[num_neuron6thLevel];
-    int input8thLayer[num_neuron7thLevel]; // or the final result of the network because we have 7 layers
-
-    //Initialization of every neuron in the network
-    initilizeNeuron(firstLevel,num_neuronFirstLevel,6.0,2.0,num_neuronFirstLevel);
-    initilizeNeuron(secondLevel,num_neuronSecondLevel,6.0,2.0,num_neuronFirstLevel);
-    initilizeNeuron(neuronsLvl3,num_neuron3rdLevel,6.0,2.0,num_neuronSecondLevel);
-    initilizeNeuron(neuronsLvl4,num_neuron4thLevel,6.0,2.0,num_neuron3rdLevel);
-    initilizeNeuron(neuronsLvl5,num_neuron5thLevel,6.0,2.0,num_neuron4thLevel);
-    initilizeNeuron(neuronsLvl6,num_neuron6thLevel,6.0,2.0,num_neuron5thLevel);
-    initilizeNeuron(neuronsLvl7,num_neuron7thLevel,6.0,2.0,num_neuron6thLevel);
-    
-
-
-    //Printf to control everything is okay
-    printf("First layer\n");
-    for (int i = 0; i < num_neuronFirstLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, firstLevel[i].potential, firstLevel[i].threshold);
-    }
+// Number of primary inputs of the input table, the inputs of a scaled network repeat it
+#define primaryInputs 16
 
-    printf("Second layer\n");
-    for (int i = 0; i < num_neuronSecondLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, secondLevel[i].potential, secondLevel[i].threshold);
-    }
+int main(int argc, char*argv[]){
 
-    printf("3rd layer\n");
-    for (int i = 0; i < num_neuron3rdLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, neuronsLvl3[i].potential, neuronsLvl3[i].threshold);
+    // Every level is scaled by the factor given on the command line, 1 by default
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale < 1) {
+        printf("usage: %s [scale]\n", argv[0]);
+        return 1;
     }
-
-    printf("4th layer\n");
-    for (int i = 0; i < num_neuron4thLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, neuronsLvl4[i].potential, neuronsLvl4[i].threshold);
+#ifdef _OPENMP
+    // Every thread needs its own ring buffer for the binary trace of the neurons
+    if (!traceFits(omp_get_max_threads())) {
+        printf("The binary trace has %d ring buffers for %d threads, build with -DSNN_TRACE_CORES=%d\n",
+               SNN_TRACE_CORES, omp_get_max_threads(), omp_get_max_threads());
+        return 1;
     }
-    printf("5th layer\n");
-    for (int i = 0; i < num_neuron5thLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, neuronsLvl5[i].potential, neuronsLvl5[i].threshold);
+#endif
+
+    // Number of inputs of the network, then the number of neurons of every level
+    const int widths[numberOfLayers + 1] = {num_neuronFirstLevel, num_neuronFirstLevel, num_neuronSecondLevel,
+        num_neuron3rdLevel, num_neuron4thLevel, num_neuron5thLevel, num_neuron6thLevel, num_neuron7thLevel};
+    const char* levelNames[numberOfLayers] = {"First", "Second", "3rd", "4th", "5th", "6th", "7th"};
+    const char* layerNames[numberOfLayers] __attribute__((unused)) = {"First", "Second", "Third", "Fourth", "Fifth", "Sixth", "Seventh"};
+
+    // The neurons, the weights and the outputs of every level are allocated for the scaled network.
+    // The output of a level is the input of the next one, the first takes the primary inputs.
+    Layer layers[numberOfLayers];
+    int* primary = malloc((size_t)widths[0] * scale * sizeof(int));
+    if (primary == NULL) {
+        printf("Cannot allocate the primary inputs\n");
+        return 1;
     }
-    printf("6th layer\n");
-    for (int i = 0; i < num_neuron6thLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, neuronsLvl6[i].potential, neuronsLvl6[i].threshold);
+    for (int l = 0; l < numberOfLayers; l++) {
+        Layer* layer = &layers[l];
+        layer->num_inputs = widths[l] * scale;
+        layer->num_neurons = widths[l + 1] * scale;
+        layer->neurons = malloc((size_t)layer->num_neurons * sizeof(Neuron));
+        layer->weights = malloc((size_t)layer->num_neurons * layer->num_inputs * sizeof(int));
+        layer->output = calloc(layer->num_neurons, sizeof(int));
+        layer->input = l == 0 ? primary : layers[l - 1].output;
+        if (layer->neurons == NULL || layer->weights == NULL || layer->output == NULL) {
+            printf("Cannot allocate the %s level\n", levelNames[l]);
+            return 1;
+        }
+        // Initialize weight matrices, and every neuron in the network
+        initializeWeights(layer->weights, layer->num_neurons, layer->num_inputs, l + 1);
+        initilizeNeuron(layer->neurons, layer->num_neurons, 6.0, 2.0, layer->num_inputs);
     }
-    printf("7th layer\n");
-    for (int i = 0; i < num_neuron7thLevel; i++) {
-        printf("Neuron %d -> potential: %.2f, threshold: %.2f\n",
-               i, neuronsLvl7[i].potential, neuronsLvl7[i].threshold);
+
+    //Printf to control everything is okay
+    for (int l = 0; l < numberOfLayers; l++) {
+        traceLayer("%s layer\n", levelNames[l]);
+        for (int i = 0; i < layers[l].num_neurons; i++) {
+            traceLayer("Neuron %d -> potential: %.2f, threshold: %.2f\n",
+                   i, layers[l].neurons[i].potential, layers[l].neurons[i].threshold);
+        }
     }
 
     //definition of primary inputs, according to # of timesteps
-    int input[16][timestep] = {
+    int input[primaryInputs][timestep] = {
         {1, 0},
         {0, 0},
         {0, 0},
@@ -183,48 +163,52 @@ int main(int argc, char*argv[]){
         {1, 0},
     };
 
-    //Simulation of the network
+    // Simulation of the network: the team of threads is created once for the whole run, the
+    // bookkeeping of a timestep and of a layer is done by a single thread, and every layer is
+    // simulated by all the threads, layer l starting when layer l-1 is complete.
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
     for (int t = 0; t < timestep; t++) {
-        init_output(inputSecondLayer, num_neuronSecondLevel);
-        init_output(inputThirdLayer, num_neuron3rdLevel);
-        init_output(input4thLayer, num_neuron4thLevel);
-        init_output(input5thLayer, num_neuron5thLevel);
-        init_output(input6thLayer, num_neuron6thLevel);
-        init_output(input7thLayer, num_neuron6thLevel);
-        init_output(input8thLayer, num_neuron7thLevel); 
-
-
-        printf("\n\n-------------------First layer-----------------------\n\n");
-        simulate(firstLevel, num_neuronFirstLevel, num_neuronFirstLevel, weightsInputsToFirst, input[t], inputSecondLayer);
-        verbose_output_of_layer(num_neuronFirstLevel,inputSecondLayer,t);
-
-
-        printf("\n\n-------------------Second layer-----------------------\n\n");
-        simulate(secondLevel, num_neuronSecondLevel, num_neuronFirstLevel, weightsFirstToSecond, inputSecondLayer, inputThirdLayer);
-        verbose_output_of_layer(num_neuronSecondLevel,inputThirdLayer,t);
-        
-        printf("\n\n-------------------Third layer-----------------------\n\n");
-        simulate(neuronsLvl3, num_neuron3rdLevel, num_neuronSecondLevel, weightsSecondToThird, inputThirdLayer, input4thLayer);
-        verbose_output_of_layer(num_neuron3rdLevel,input4thLayer,t);
-        
-        printf("\n\n-------------------Fourth layer-----------------------\n\n");
-        simulate(neuronsLvl4, num_neuron4thLevel, num_neuron3rdLevel, weightsThirdToFourth, input4thLayer, input5thLayer);
-        verbose_output_of_layer(num_neuron4thLevel,input5thLayer,t);
-        
-        printf("\n\n-------------------Fifth layer-----------------------\n\n");
-        simulate(neuronsLvl5, num_neuron5thLevel, num_neuron4thLevel, weightsFifthToSixth, input5thLayer, input6thLayer);
-        verbose_output_of_layer(num_neuron5thLevel,input6thLayer,t);
-
-
-        printf("\n\n-------------------Sixth layer-----------------------\n\n");
-        simulate(neuronsLvl6, num_neuron6thLevel, num_neuron5thLevel, weightsSixthToSeventh, input6thLayer, input7thLayer);
-        verbose_output_of_layer(num_neuron6thLevel,input7thLayer,t);
-
-        printf("\n\n-------------------Seventh layer-----------------------\n\n");
-        simulate(neuronsLvl7, num_neuron7thLevel, num_neuron6thLevel, weightsSixthToSeventh, input7thLayer, input8thLayer);  // only the result
-        verbose_output_of_layer(num_neuron7thLevel,input8thLayer,t);
-
+#ifdef _OPENMP
+        #pragma omp single
+#endif
+        {
+            traceSummary("\n\n-------------------Timestep %d-----------------------\n\n", t);
+            traceSetTimestep(t);
+            for (int j = 0; j < layers[0].num_inputs; j++) {
+                primary[j] = input[j % primaryInputs][t];
+            }
+            for (int l = 0; l < numberOfLayers; l++) {
+                init_output(layers[l].output, layers[l].num_neurons);
+            }
+        }
+        for (int l = 0; l < numberOfLayers; l++) {
+            // The output of the previous layer is complete, so it is printed with the header of this one
+#ifdef _OPENMP
+            #pragma omp single
+#endif
+            {
+                if (l > 0) {
+                    verbose_output_of_layer(layers[l - 1].num_neurons, layers[l - 1].output, t);
+                }
+                traceLayer("\n\n-------------------%s layer-----------------------\n\n", layerNames[l]);
+                traceSetLayer(l);
+            }
+            simulate(&layers[l]);
+        }
+#ifdef _OPENMP
+        #pragma omp single
+#endif
+        verbose_output_of_layer(layers[numberOfLayers - 1].num_neurons, layers[numberOfLayers - 1].output, t);  // only the result
     }
+    traceDump();
 
+    for (int l = 0; l < numberOfLayers; l++) {
+        free(layers[l].neurons);
+        free(layers[l].weights);
+        free(layers[l].output);
+    }
+    free(primary);
     return 0;
 }
@@ -14,22 +14,50 @@ typedef struct {
     int num_inputs;
 } Neuron;
 
-// Constants for the number of neurons at each level
+// Layer of the network: its neurons, their weights and the spikes it reads and writes
+typedef struct {
+    Neuron* neurons;
+    int num_neurons;
+    int num_inputs;
+    int* weights;       // One row of num_inputs weights for every neuron
+    int* input;         // Output of the previous layer, or the primary inputs
+    int* output;        // Spikes of the layer, input of the next one
+} Layer;
+
+// Constants for the number of neurons at each level, they can be given at compile time
+// and are multiplied by the scale given on the command line
+#ifndef num_neuronFirstLevel
 #define num_neuronFirstLevel 16
+#endif
+#ifndef num_neuronSecondLevel
 #define num_neuronSecondLevel 14
+#endif
+#ifndef num_neuron3rdLevel
 #define num_neuron3rdLevel 12
+#endif
+#ifndef num_neuron4thLevel
 #define num_neuron4thLevel 10
+#endif
+#ifndef num_neuron5thLevel
 #define num_neuron5thLevel 8
+#endif
+#ifndef num_neuron6thLevel
 #define num_neuron6thLevel 6
+#endif
+#ifndef num_neuron7thLevel
 #define num_neuron7thLevel 4
+#endif
+
+#define numberOfLayers 7
 
 #define timestep 2
 
 // Function prototypes
 void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer);
-void initializeWeights(int weights[][16], int rows, int columns);
+void initializeWeights(int* weights, int rows, int columns, unsigned seed);
 void initilizeNeuron(Neuron *n, int num_neuron, double threshold, double resetValue, int num_inputs);
 void init_output(int *input_to_the_Layer, int num_neuron_on_the_Level);
 void verbose_output_of_layer(int num_neurono_of_the_Level, int* input8thLayer, int t);
+void simulate(Layer* layer);
 
 #endif // NEURON_H
@@ -0,0 +1,175 @@
+/**
+ * @file fixedPoint.h
+ * @brief Q-format fixed-point arithmetic and neuron update rules for the FPU-less GAP8 cluster.
+ *
+ * The format is selected at compile time with FIXED_FRAC_BITS:
+ * - 16: Q16.16, values are stored on int32_t and products use a 64 bit intermediate.
+ * - 8: Q8.8, values are stored on int16_t and products use a 32 bit intermediate.
+ *
+ * Every operation that can overflow the storage type saturates, so a neuron driven by a huge
+ * input current clips instead of wrapping around.
+ */
+
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+#ifndef FIXED_FRAC_BITS
+#define FIXED_FRAC_BITS 16
+#endif
+
+#if FIXED_FRAC_BITS == 16
+typedef int32_t fixed_t;        // Q16.16 value
+typedef int64_t fixed_wide_t;   // Intermediate of products and sums
+#define FIXED_MAX INT32_MAX
+#define FIXED_MIN INT32_MIN
+#elif FIXED_FRAC_BITS == 8
+typedef int16_t fixed_t;        // Q8.8 value
+typedef int32_t fixed_wide_t;   // Intermediate of products and sums
+#define FIXED_MAX INT16_MAX
+#define FIXED_MIN INT16_MIN
+#else
+#error "FIXED_FRAC_BITS must be 16 (Q16.16) or 8 (Q8.8)"
+#endif
+
+/**
+ * @brief The value 1.0 in the selected format.
+ */
+#define FIXED_ONE ((fixed_wide_t)1 << FIXED_FRAC_BITS)
+
+/**
+ * @brief Conversions between fixed-point and int/double.
+ *
+ * FIXED_FROM_DOUBLE is meant for constants and for the initialization, never for the hot path.
+ */
+#define FIXED_FROM_INT(x) ((fixed_t)((x) * FIXED_ONE))
+#define FIXED_FROM_DOUBLE(x) ((fixed_t)((x) >= 0 ? (x) * FIXED_ONE + 0.5 : (x) * FIXED_ONE - 0.5))
+#define FIXED_TO_DOUBLE(x) ((double)(x) / FIXED_ONE)
+
+/**
+ * @brief Saturation of a wide intermediate to the storage type.
+ */
+static inline fixed_t fixed_sat(fixed_wide_t x)
+{
+    if (x > FIXED_MAX) return FIXED_MAX;
+    if (x < FIXED_MIN) return FIXED_MIN;
+    return (fixed_t)x;
+}
+
+/**
+ * @brief Product of two fixed-point values, kept on the wide type.
+ */
+static inline fixed_wide_t fixed_mul_wide(fixed_wide_t a, fixed_wide_t b)
+{
+    return (a * b) >> FIXED_FRAC_BITS;
+}
+
+/**
+ * @brief Saturated product of two fixed-point values.
+ */
+static inline fixed_t fixed_mul(fixed_t a, fixed_t b)
+{
+    return fixed_sat(fixed_mul_wide(a, b));
+}
+
+/**
+ * @brief Saturated quotient of two fixed-point values.
+ */
+static inline fixed_t fixed_div(fixed_t a, fixed_t b)
+{
+    return fixed_sat(((fixed_wide_t)a * FIXED_ONE) / b);
+}
+
+/**
+ * @brief Saturated sum of a fixed-point value and an integer, used to add the synaptic current.
+ */
+static inline fixed_t fixed_add_int(fixed_t a, int32_t i)
+{
+    return fixed_sat((fixed_wide_t)a + (fixed_wide_t)i * FIXED_ONE);
+}
+
+
+/**
+ * @brief Number of fractional bits of the LIF decay multiplier.
+ *
+ * It is the largest shift for which (v - reset) * multiplier cannot overflow the wide type.
+ */
+#if FIXED_FRAC_BITS == 8
+#define FIXED_DECAY_SHIFT 14
+#else
+#define FIXED_DECAY_SHIFT 30
+#endif
+
+/**
+ * @brief Leak of a LIF neuron toward its reset potential, with integer operations only.
+ *
+ * The decay factor exp(-1/tau) is computed once at the initialization and given as the pair
+ * multiplier/shift, decay = multiplier / 2^shift, so every timestep costs one multiplication
+ * and one shift.
+ *
+ * @param potential Membrane potential
+ * @param reset Reset (rest) potential
+ * @param multiplier Multiplier of the decay factor
+ * @param shift Shift of the decay factor
+ * @return The potential after one timestep of leak
+ */
+static inline fixed_t fixed_lif_decay(fixed_t potential, fixed_t reset, int32_t multiplier, int shift)
+{
+    fixed_wide_t delta = (fixed_wide_t)potential - reset;
+    fixed_wide_t rounding = (fixed_wide_t)1 << (shift - 1);
+    return fixed_sat(reset + ((delta * multiplier + rounding) >> shift));
+}
+
+/**
+ * @brief The 0.04v^2 term of Izhikevich, given v^2.
+ *
+ * In Q8.8 the constant 0.04 would be rounded to 10/256 (2.3% error), so it is applied as 41/1024.
+ * It only uses operators, so it also works on the vectors of the wide type.
+ */
+#if FIXED_FRAC_BITS == 8
+#define FIXED_IZHI_QUADRATIC(v2) (((v2) * 41) >> 10)
+#else
+#define FIXED_IZHI_QUADRATIC(v2) (((v2) * (fixed_wide_t)FIXED_FROM_DOUBLE(0.04)) >> FIXED_FRAC_BITS)
+#endif
+
+/**
+ * @brief One forward Euler sub-step of 2^-shift ms of the Izhikevich equations, with integer operations only.
+ *
+ * v' = v + (0.04v^2 + 5v + 140 - u + I) / 2^shift
+ * u' = u + a(bv - u) / 2^shift
+ * The polynomial is evaluated on the wide type, so v^2 never overflows, and saturated at the end.
+ *
+ * @param v Membrane potential, updated in place
+ * @param u Recovery variable, updated in place
+ * @param a Parameter 'a' of Izhikevich
+ * @param b Parameter 'b' of Izhikevich
+ * @param current Synaptic input current, integer
+ * @param shift The sub-step is 2^-shift ms, 0 for a whole step
+ */
+static inline void fixed_izhi_substep(fixed_t* v, fixed_t* u, fixed_t a, fixed_t b, int32_t current, int shift)
+{
+    fixed_wide_t v_old = *v;
+    fixed_wide_t v2 = fixed_mul_wide(v_old, v_old);
+    fixed_wide_t dv = FIXED_IZHI_QUADRATIC(v2) + 5 * v_old + 140 * FIXED_ONE
+                      - *u + (fixed_wide_t)current * FIXED_ONE;
+    fixed_wide_t du = fixed_mul_wide(a, fixed_mul_wide(b, v_old) - *u);
+    *v = fixed_sat(v_old + (dv >> shift));
+    *u = fixed_sat(*u + (du >> shift));
+}
+
+/**
+ * @brief One forward Euler step of 1 ms of the Izhikevich equations, with integer operations only.
+ *
+ * @param v Membrane potential, updated in place
+ * @param u Recovery variable, updated in place
+ * @param a Parameter 'a' of Izhikevich
+ * @param b Parameter 'b' of Izhikevich
+ * @param current Synaptic input current, integer
+ */
+static inline void fixed_izhi_step(fixed_t* v, fixed_t* u, fixed_t a, fixed_t b, int32_t current)
+{
+    fixed_izhi_substep(v, u, a, b, current, 0);
+}
+
+#endif // FIXED_POINT_H
@@ -0,0 +1,52 @@
+/**
+ * @file GapBuiltins.h
+ * @brief Host (Linux) emulation of the GAP8 builtins used by the SNN engines.
+ *
+ * Every builtin is a plain C macro with the same semantics as the PULP instruction,
+ * so the engines compute exactly the same indexes on host and on GAP8.
+ */
+
+#ifndef GAP_BUILTINS_HOST_H
+#define GAP_BUILTINS_HOST_H
+
+#include <stdint.h>
+
+/**
+ * @brief Signed multiplication of the 16 lower bits of the operands (p.muls).
+ */
+#define gap_muls(x, y) ((int32_t)(int16_t)(x) * (int32_t)(int16_t)(y))
+
+/**
+ * @brief Unsigned addition followed by a logical right shift of norm bits (p.addNru).
+ */
+#define gap_addnormu(x, y, norm) ((int32_t)((uint32_t)((x) + (y)) >> (norm)))
+
+/**
+ * @brief Signed addition followed by an arithmetic right shift of norm bits (p.addN).
+ */
+#define gap_addnorm(x, y, norm) ((int32_t)((x) + (y)) >> (norm))
+
+/**
+ * @brief Packed SIMD vectors of the PULP extensions.
+ */
+typedef signed short v2s __attribute__((vector_size(4)));
+typedef signed char v4s __attribute__((vector_size(4)));
+
+/**
+ * @brief Packing of two 16 bit values in a v2s (pv.pack.h).
+ */
+#define gap_pack2(x, y) ((v2s){(signed short)(x), (signed short)(y)})
+
+/**
+ * @brief Signed 16x16 multiplication with rounding and normalization by norm bits (p.mulsRN).
+ */
+#define gap_mulsRN(x, y, norm) \
+    ((int32_t)(((int32_t)(int16_t)(x) * (int32_t)(int16_t)(y) + (1 << ((norm) - 1))) >> (norm)))
+
+/**
+ * @brief Sum of the products of the four signed bytes of two v4s, added to an accumulator (pv.sdotsp.b).
+ */
+#define gap_sumdotp4(x, y, acc) \
+    ((int32_t)(acc) + (x)[0] * (y)[0] + (x)[1] * (y)[1] + (x)[2] * (y)[2] + (x)[3] * (y)[3])
+
+#endif // GAP_BUILTINS_HOST_H
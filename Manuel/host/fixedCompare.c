@@ -0,0 +1,161 @@
+/**
+ * @file fixedCompare.c
+ * @brief Host-side accuracy comparison of the fixed-point neuron models against the double reference.
+ *
+ * A population of LIF and Izhikevich neurons is driven with the same pseudo-random integer
+ * currents in double and in fixed-point, and for every model we report the maximum and mean
+ * absolute error of the membrane potential and how many spikes are different.
+ * The double reference uses the same equations as update_neuron in parallelLIF.c and parallelIzhi.c.
+ *
+ *     gcc -O2 -IManuel Manuel/host/fixedCompare.c -lm -o fixedCompare && ./fixedCompare
+ *     gcc -O2 -IManuel -DFIXED_FRAC_BITS=8 Manuel/host/fixedCompare.c -lm -o fixedCompare && ./fixedCompare
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "fixedPoint.h"
+
+#define compareNeurons 64
+#define compareTimesteps 1000
+
+/**
+ * @brief Accumulated error between the reference and the fixed-point model.
+ */
+typedef struct {
+    double maxError;
+    double sumError;
+    long samples;
+    long referenceSpikes;
+    long spikeMismatches;
+} CompareResult;
+
+/** @brief State of the linear congruential generator of the input currents. */
+static unsigned int seed = 12345;
+
+/**
+* @brief Pseudo-random synaptic current.
+*
+* The current is the sum of the integer weights of the active inputs, like in the engines.
+Most timesteps have no input, the others have a current between 0 and maxCurrent.
+*
+* @param maxCurrent Maximum current
+*/
+
+static int randomCurrent(int maxCurrent)
+{
+    seed = seed * 1103515245u + 12345u;
+    unsigned int r = (seed >> 16) & 0x7fff;
+    if (r % 4 != 0) {
+        return 0;
+    }
+    return (int)((r >> 2) % (maxCurrent + 1));
+}
+
+static void accumulate(CompareResult* result, double reference, fixed_t value, int referenceSpike, int spike)
+{
+    double error = fabs(reference - FIXED_TO_DOUBLE(value));
+    if (error > result->maxError) {
+        result->maxError = error;
+    }
+    result->sumError += error;
+    result->samples++;
+    result->referenceSpikes += referenceSpike;
+    result->spikeMismatches += (referenceSpike != spike);
+}
+
+static void report(const char* model, CompareResult* result)
+{
+    printf("%-12s max |dv| %8.4f mV   mean |dv| %8.4f mV   spikes %6ld   spike mismatches %6ld\n",
+           model, result->maxError, result->sumError / result->samples,
+           result->referenceSpikes, result->spikeMismatches);
+}
+
+/**
+* @brief Comparison of the LIF model.
+*
+* The parameters are the ones used by cluster_neuronInstanziation in parallelLIF.c.
+*/
+
+static void compareLIF(void)
+{
+    const double threshold = -50.0, reset = -65.0, tau = 10.0;
+    const fixed_t thresholdFixed = FIXED_FROM_DOUBLE(threshold);
+    const fixed_t resetFixed = FIXED_FROM_DOUBLE(reset);
+    const int32_t decayMultiplier = (int32_t)(exp(-1.0 / tau) * ((fixed_wide_t)1 << FIXED_DECAY_SHIFT) + 0.5);
+    CompareResult result = {0};
+
+    for (int n = 0; n < compareNeurons; n++) {
+        double v = -65.0;
+        fixed_t vFixed = FIXED_FROM_DOUBLE(-65.0);
+        for (int t = 0; t < compareTimesteps; t++) {
+            int current = randomCurrent(8);
+            int spike = 0, spikeFixed = 0;
+
+            v += current;
+            v = reset + (v - reset) * exp(-1.0 / tau);
+            if (v >= threshold) {
+                spike = 1;
+                v = reset;
+            }
+
+            vFixed = fixed_add_int(vFixed, current);
+            vFixed = fixed_lif_decay(vFixed, resetFixed, decayMultiplier, FIXED_DECAY_SHIFT);
+            if (vFixed >= thresholdFixed) {
+                spikeFixed = 1;
+                vFixed = resetFixed;
+            }
+            accumulate(&result, v, vFixed, spike, spikeFixed);
+        }
+    }
+    report("LIF", &result);
+}
+
+/**
+* @brief Comparison of the Izhikevich model.
+*
+* The parameters are the ones used by cluster_neuronInstanziation in parallelIzhi.c.
+*/
+
+static void compareIzhikevich(void)
+{
+    const double a = 0.02, b = 0.2, c = -65.0, d = 8.0;
+    const fixed_t aFixed = FIXED_FROM_DOUBLE(a), bFixed = FIXED_FROM_DOUBLE(b);
+    const fixed_t cFixed = FIXED_FROM_DOUBLE(c), dFixed = FIXED_FROM_DOUBLE(d);
+    CompareResult result = {0};
+
+    for (int n = 0; n < compareNeurons; n++) {
+        double v = -65.0, u = b * -65.0;
+        fixed_t vFixed = FIXED_FROM_DOUBLE(-65.0), uFixed = FIXED_FROM_DOUBLE(b * -65.0);
+        for (int t = 0; t < compareTimesteps; t++) {
+            int current = randomCurrent(20);
+            int spike = 0, spikeFixed = 0;
+
+            double v_old = v;
+            v += 0.04 * v_old * v_old + 5 * v_old + 140 - u + current;
+            u += a * (b * v_old - u);
+            if (v >= 30) {
+                spike = 1;
+                v = c;
+                u += d;
+            }
+
+            fixed_izhi_step(&vFixed, &uFixed, aFixed, bFixed, current);
+            if (vFixed >= FIXED_FROM_DOUBLE(30)) {
+                spikeFixed = 1;
+                vFixed = cFixed;
+                uFixed = fixed_sat((fixed_wide_t)uFixed + dFixed);
+            }
+            accumulate(&result, v, vFixed, spike, spikeFixed);
+        }
+    }
+    report("Izhikevich", &result);
+}
+
+int main(void)
+{
+    printf("Fixed-point format Q%d.%d, %d neurons, %d timesteps\n",
+           (int)(8 * sizeof(fixed_t)) - FIXED_FRAC_BITS, FIXED_FRAC_BITS, compareNeurons, compareTimesteps);
+    compareLIF();
+    compareIzhikevich();
+    return 0;
+}
@@ -0,0 +1,154 @@
+/**
+ * @file modelExport.c
+ * @brief Host tool writing a LIF model file (see snnModel.h).
+ *
+ * The layer sizes are given on the command line, the first one being the number of primary inputs.
+ * The neurons get the standard LIF parameters of parallelLIF.c and the weights are the ones
+ * of initialize_weights, the number of the core (neuron % 8) that instanziates the neuron,
+ * so the default network exported as 10 10 8 3 simulates exactly like the compiled one.
+ * With -w8 or -w4 the weights are stored as int8 or int4 with a scale per neuron, quantized like
+ * the LIF engine does with WEIGHT_BITS 8 or 4, so an engine built with the same bits uses them as they are.
+ * Trained networks are exported with the same layout.
+ *
+ *     gcc -O2 -IManuel Manuel/host/modelExport.c -o modelExport
+ *     ./modelExport [-w8|-w4] model.snn 10 10 8 3
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snnModel.h"
+
+#define exportMaxLayers 64
+
+/**
+ * @brief Layer size given on the command line.
+ *
+ * @return The size, or 0 if the argument is not a positive number that fits an int
+ */
+static uint32_t parseSize(const char* text)
+{
+    char* end;
+    errno = 0;
+    long size = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno == ERANGE || size < 1 || size > INT32_MAX) {
+        return 0;
+    }
+    return (uint32_t)size;
+}
+
+/**
+ * @brief Quantization of a row of int32 weights, with the rules of the LIF engine.
+ *
+ * The scale is the smallest integer for which the largest weight fits the range of q, and every weight
+ * is rounded to the nearest multiple of the scale. The padding of the row is cleared.
+ *
+ * @param type SNN_WEIGHT_INT8 or SNN_WEIGHT_INT4
+ * @param source The weights of the neuron
+ * @param count Number of weights
+ * @param row The stored row, modelRowBytes(type, count) bytes
+ * @return The scale of the neuron
+ */
+static int32_t quantizeRow(uint32_t type, const int32_t* source, uint32_t count, uint8_t* row)
+{
+    int32_t qMax = type == SNN_WEIGHT_INT8 ? 127 : 7;
+    int32_t largest = 0;
+    for (uint32_t j = 0; j < count; j++) {
+        int32_t magnitude = source[j] >= 0 ? source[j] : -source[j];
+        largest = magnitude > largest ? magnitude : largest;
+    }
+    int32_t scale = largest > qMax ? (largest + qMax - 1) / qMax : 1;
+    memset(row, 0, modelRowBytes(type, count));
+    for (uint32_t j = 0; j < count; j++) {
+        int32_t q = (source[j] >= 0 ? source[j] + scale / 2 : source[j] - scale / 2) / scale;
+        q = q > qMax ? qMax : (q < -qMax ? -qMax : q);
+        if (type == SNN_WEIGHT_INT8) {
+            row[j] = (uint8_t)(int8_t)q;
+        } else {
+            row[j >> 1] |= (uint8_t)((q & 0xf) << ((j & 1) ? 4 : 0));
+        }
+    }
+    return scale;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t type = SNN_WEIGHT_INT32;
+    int first = 1;
+    if (argc > 1 && (strcmp(argv[1], "-w8") == 0 || strcmp(argv[1], "-w4") == 0)) {
+        type = argv[1][2] == '8' ? SNN_WEIGHT_INT8 : SNN_WEIGHT_INT4;
+        first = 2;
+    }
+    if (argc - first < 3 || argc - first - 2 > exportMaxLayers) {
+        printf("usage: %s [-w8|-w4] model.snn inputs neurons1 [neurons2 ...]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[first];
+    int layerCount = argc - first - 2;
+    SnnModelHeader header = {SNN_MODEL_MAGIC, SNN_MODEL_VERSION, (uint16_t)layerCount, SNN_MODEL_LIF, type};
+    SnnModelLayer layers[exportMaxLayers] = {{0}};
+    uint64_t offset = sizeof(SnnModelHeader) + layerCount * sizeof(SnnModelLayer);
+    for (int l = 0; l < layerCount; l++) {
+        layers[l].num_inputs = parseSize(argv[first + l + 1]);
+        layers[l].neuronNumber = parseSize(argv[first + l + 2]);
+        if (layers[l].num_inputs == 0 || layers[l].neuronNumber == 0) {
+            printf("Layer sizes must be positive numbers\n");
+            return 1;
+        }
+        layers[l].params[SNN_LIF_THRESHOLD] = SNN_PARAM_FROM_DOUBLE(-50.0);
+        layers[l].params[SNN_LIF_RESET] = SNN_PARAM_FROM_DOUBLE(-65.0);
+        layers[l].params[SNN_LIF_TAU] = SNN_PARAM_FROM_DOUBLE(10.0);
+        layers[l].weightOffset = (uint32_t)offset;
+        offset += (uint64_t)layers[l].neuronNumber * modelRowBytes(type, layers[l].num_inputs);
+        if (type != SNN_WEIGHT_INT32) {
+            layers[l].scaleOffset = (uint32_t)offset;
+            offset += (uint64_t)layers[l].neuronNumber * sizeof(int32_t);
+        }
+        if (offset > UINT32_MAX) {
+            printf("The model does not fit in 4 GB\n");
+            return 1;
+        }
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Cannot create %s\n", path);
+        return 1;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(layers, sizeof(SnnModelLayer), layerCount, file);
+    for (int l = 0; l < layerCount; l++) {
+        uint32_t inputs = layers[l].num_inputs;
+        int32_t* source = malloc(inputs * sizeof(int32_t));
+        uint8_t* row = malloc(modelRowBytes(type, inputs));
+        int32_t* scales = malloc(layers[l].neuronNumber * sizeof(int32_t));
+        if (source == NULL || row == NULL || scales == NULL) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        for (uint32_t n = 0; n < layers[l].neuronNumber; n++) {
+            for (uint32_t i = 0; i < inputs; i++) {
+                source[i] = n % 8;
+            }
+            if (type == SNN_WEIGHT_INT32) {
+                fwrite(source, sizeof(int32_t), inputs, file);
+            } else {
+                scales[n] = quantizeRow(type, source, inputs, row);
+                fwrite(row, 1, modelRowBytes(type, inputs), file);
+            }
+        }
+        if (type != SNN_WEIGHT_INT32) {
+            fwrite(scales, sizeof(int32_t), layers[l].neuronNumber, file);
+        }
+        free(source);
+        free(row);
+        free(scales);
+    }
+    if (fclose(file) != 0) {
+        printf("Cannot write %s\n", path);
+        return 1;
+    }
+    printf("%s: %d layers, %u bytes\n", path, layerCount, (unsigned)offset);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file pmsis.h
+ * @brief Host (Linux) emulation of the subset of PMSIS used by the SNN engines.
+ *
+ * This header replaces the GAP SDK pmsis.h when the engines are compiled natively,
+ * so parallelLIF.c and parallelIzhi.c build without modifications:
+ *
+ *     gcc -O2 -IManuel/host Manuel/parallelLIF.c Manuel/host/pmsisHost.c -lpthread -lm
+ *
+ * The cluster is emulated by a pool of persistent pthreads pinned to the CPUs. pi_cl_team_fork
+ * dispatches the entry to the team and waits for its end, and pi_cl_team_barrier is a real barrier
+ * between the workers (spinning, then sleeping on a futex), so the cluster code keeps the same
+ * synchronization it has on GAP8. PMSIS_HOST_PIN=0 disables the pinning, PMSIS_HOST_SPIN sets the
+ * iterations spent spinning at a barrier before sleeping.
+ * The number of cores is PMSIS_HOST_NB_CORES, and it can be overridden at runtime
+ * with the environment variable of the same name.
+ */
+
+#ifndef PMSIS_HOST_H
+#define PMSIS_HOST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Default number of emulated cluster cores (the GAP8 cluster has 8).
+ */
+#ifndef PMSIS_HOST_NB_CORES
+#define PMSIS_HOST_NB_CORES 8
+#endif
+
+/**
+ * @brief Upper bound on the number of emulated cluster cores.
+ */
+#define PMSIS_HOST_MAX_CORES 64
+
+/**
+ * @brief Generic device handle, only used to carry the cluster configuration.
+ */
+struct pi_device {
+    void *config;
+    void *data;
+};
+
+/**
+ * @brief Cluster configuration, only the id is meaningful on host.
+ */
+struct pi_cluster_conf {
+    int id;
+};
+
+/**
+ * @brief Task sent from the fabric controller to the cluster.
+ */
+struct pi_cluster_task {
+    void (*entry)(void *arg);
+    void *arg;
+};
+
+/* Cluster management */
+void pi_cluster_conf_init(struct pi_cluster_conf *conf);
+void pi_open_from_conf(struct pi_device *device, void *conf);
+int pi_cluster_open(struct pi_device *device);
+int pi_cluster_close(struct pi_device *device);
+struct pi_cluster_task *pi_cluster_task(struct pi_cluster_task *task, void (*entry)(void *), void *arg);
+int pi_cluster_send_task_to_cl(struct pi_device *device, struct pi_cluster_task *task);
+
+/* Team management, callable from cluster code */
+void pi_cl_team_fork(int nb_cores, void (*entry)(void *), void *arg);
+void pi_cl_team_barrier(void);
+int pi_cl_team_nb_cores(void);
+uint32_t pi_cl_cluster_nb_cores(void);
+uint32_t pi_core_id(void);
+uint32_t pi_cluster_id(void);
+
+/**
+ * @brief Casting wrappers of the entry points.
+ *
+ * The engines pass cluster functions taking a typed pointer (a layer or a network), as the GAP SDK
+ * accepts. Current host compilers reject the conversion to void (*)(void *), so the entry is cast
+ * here once, and the engines keep the calls they have on GAP8.
+ */
+#define pi_cluster_task(task, entry, arg) pi_cluster_task((task), (void (*)(void *))(entry), (arg))
+#define pi_cl_team_fork(nb_cores, entry, arg) pi_cl_team_fork((nb_cores), (void (*)(void *))(entry), (arg))
+
+/* Critical section of the cluster, a single mutex shared by all the cores like on GAP8 */
+void pi_cl_team_critical_enter(void);
+void pi_cl_team_critical_exit(void);
+
+/* Memory, on host every level is the heap */
+void *pi_l1_malloc(struct pi_device *device, size_t size);
+void pi_l1_free(struct pi_device *device, void *chunk, size_t size);
+void *pi_l2_malloc(size_t size);
+void pi_l2_free(void *chunk, size_t size);
+
+/**
+ * @brief Cluster DMA transfer between L2 (ext) and L1 (loc).
+ *
+ * On host the addresses are pointers, so they are uintptr_t instead of uint32_t.
+ */
+typedef enum {
+    PI_CL_DMA_DIR_LOC2EXT = 0,
+    PI_CL_DMA_DIR_EXT2LOC = 1
+} pi_cl_dma_dir_e;
+
+typedef struct pi_cl_dma_copy_s {
+    uintptr_t ext;
+    uintptr_t loc;
+    uint32_t size;
+    pi_cl_dma_dir_e dir;
+    uint8_t merge;
+    uint32_t id;
+} pi_cl_dma_copy_t;
+
+/* Cluster DMA, on host the copy is done when it is issued and the wait returns immediately */
+void pi_cl_dma_memcpy(pi_cl_dma_copy_t *copy);
+void pi_cl_dma_wait(pi_cl_dma_copy_t *copy);
+
+/* Runtime entry and exit */
+int pmsis_kickoff(void *arg);
+void pmsis_exit(int err);
+
+#endif // PMSIS_HOST_H
@@ -0,0 +1,563 @@
+/**
+ * @file pmsisHost.c
+ * @brief pthread implementation of the host PMSIS emulation.
+ *
+ * The fabric controller is the main thread. A cluster task runs on the calling thread,
+ * which becomes core 0 of the cluster, exactly like the master core on GAP8.
+ * The other cores are a pool of persistent workers, started at the first pi_cl_team_fork and
+ * stopped by pi_cluster_close, each pinned to its own CPU: a fork only wakes them and waits for
+ * them on a barrier, so it costs two barriers instead of the creation and the join of the threads,
+ * like the dispatch of the team on the cluster.
+ * The barriers spin for PMSIS_HOST_SPIN iterations, then sleep on a futex, so the workers don't
+ * burn the CPUs between two tasks of the fabric controller.
+ */
+
+#define _GNU_SOURCE
+#include "pmsis.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/** @brief Iterations a core spins at a barrier before sleeping, PMSIS_HOST_SPIN in the environment. */
+#ifndef PMSIS_HOST_SPIN
+#define PMSIS_HOST_SPIN 20000
+#endif
+
+/**
+ * @brief Sense-reversing barrier.
+ *
+ * The sense is the parity of generation, incremented by the last core that arrives: every core
+ * waits until it differs from the one it read when it arrived, so the barrier can be reused at
+ * once. The generation is also the futex word the sleeping cores wait on.
+ */
+typedef struct {
+    atomic_int arrived;     // Cores arrived in the current generation
+    atomic_int generation;  // Number of completed generations
+    atomic_int sleepers;    // Cores sleeping on the futex
+    int cores;              // Cores of the team
+} HostBarrier;
+
+/** @brief Number of cores of the emulated cluster, set by pi_cluster_open. */
+static int clusterCores = PMSIS_HOST_NB_CORES;
+
+/** @brief Core id of the calling thread, the fabric controller is core 0 as well. */
+static __thread uint32_t hostCoreId = 0;
+
+/** @brief Number of cores of the team the calling thread belongs to. */
+static __thread int hostTeamCores = 1;
+
+/** @brief Barrier of the team the calling thread belongs to. */
+static __thread HostBarrier *hostTeamBarrier = NULL;
+
+/** @brief Mutex of the critical section of the cluster. */
+static pthread_mutex_t hostCritical = PTHREAD_MUTEX_INITIALIZER;
+
+/** @brief Iterations of spinning of the barriers. */
+static int hostSpin = PMSIS_HOST_SPIN;
+
+/**
+ * @brief Arguments of one worker of a team.
+ */
+typedef struct {
+    uint32_t core_id;
+    int nb_cores;
+    HostBarrier *barrier;
+    void (*entry)(void *);
+    void *arg;
+} HostWorker;
+
+/**
+ * @brief Persistent workers of the cluster, the cores 1..cores-1.
+ *
+ * Between two forks the workers wait on dispatch. A fork publishes the entry of the team and
+ * passes dispatch with them, then core 0 and the workers of the team run the entry, and they
+ * all pass dispatch again at the end, so the fork returns when the team is done.
+ */
+typedef struct {
+    pthread_t threads[PMSIS_HOST_MAX_CORES];
+    int cores;                  // Cores of the pool, core 0 included, 0 if the pool is stopped
+    HostBarrier dispatch;       // Start and end of a fork, all the cores of the pool
+    HostBarrier team;           // Barrier of the forked team
+    int teamCores;              // Cores of the forked team
+    void (*entry)(void *);
+    void *arg;
+    int stop;                   // The workers return at the next dispatch
+} HostPool;
+
+static HostPool hostPool;
+
+
+#if defined(__linux__)
+static void hostFutexWait(atomic_int *word, int value)
+{
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+
+static void hostFutexWake(atomic_int *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#else
+static void hostFutexWait(atomic_int *word, int value)
+{
+    (void)word;
+    (void)value;
+    sched_yield();
+}
+
+
+static void hostFutexWake(atomic_int *word)
+{
+    (void)word;
+}
+#endif
+
+
+static void hostBarrierInit(HostBarrier *barrier, int cores)
+{
+    atomic_store(&barrier->arrived, 0);
+    atomic_store(&barrier->generation, 0);
+    atomic_store(&barrier->sleepers, 0);
+    barrier->cores = cores;
+}
+
+
+/**
+* @brief Wait of a core at a barrier.
+*
+* The last core to arrive resets the count and flips the sense, waking the sleeping cores if any.
+The others spin on the sense, then sleep on the futex until it changes: a core announces itself
+in sleepers before the futex compares the generation, so the last core either sees it or the
+futex sees the new generation and doesn't sleep.
+*
+* @param barrier The barrier
+*/
+
+static void hostBarrierWait(HostBarrier *barrier)
+{
+    int generation = atomic_load(&barrier->generation);
+    if (atomic_fetch_add(&barrier->arrived, 1) + 1 == barrier->cores) {
+        atomic_store(&barrier->arrived, 0);
+        atomic_fetch_add(&barrier->generation, 1);
+        if (atomic_load(&barrier->sleepers) > 0) {
+            hostFutexWake(&barrier->generation);
+        }
+        return;
+    }
+    for (int i = 0; i < hostSpin; i++) {
+        if (atomic_load_explicit(&barrier->generation, memory_order_acquire) != generation) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    atomic_fetch_add(&barrier->sleepers, 1);
+    while (atomic_load(&barrier->generation) == generation) {
+        hostFutexWait(&barrier->generation, generation);
+    }
+    atomic_fetch_sub(&barrier->sleepers, 1);
+}
+
+
+/**
+* @brief Pinning of the calling thread to the CPU of a core.
+*
+* The core c runs on the c-th CPU the process is allowed to use, modulo their number, so the
+cores stay on distinct CPUs when there are enough of them. Setting PMSIS_HOST_PIN to 0 disables it.
+*
+* @param core_id The core
+*/
+
+static void hostPin(uint32_t core_id)
+{
+#if defined(__linux__)
+    const char *env = getenv("PMSIS_HOST_PIN");
+    cpu_set_t allowed, target;
+    if ((env != NULL && atoi(env) == 0) || sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return;
+    }
+    int count = CPU_COUNT(&allowed), skip = core_id % count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && skip-- == 0) {
+            CPU_ZERO(&target);
+            CPU_SET(cpu, &target);
+            pthread_setaffinity_np(pthread_self(), sizeof(target), &target);
+            return;
+        }
+    }
+#else
+    (void)core_id;
+#endif
+}
+
+
+/**
+* @brief Body of a worker thread.
+*
+* It sets the thread local state of the core, so pi_core_id and pi_cl_team_barrier
+work as on the cluster, and runs the forked entry.
+*
+* @param data The HostWorker describing this core
+*/
+
+static void *hostWorkerMain(void *data)
+{
+    HostWorker *worker = (HostWorker *)data;
+    hostCoreId = worker->core_id;
+    hostTeamCores = worker->nb_cores;
+    hostTeamBarrier = worker->barrier;
+    worker->entry(worker->arg);
+    return NULL;
+}
+
+
+/**
+* @brief Body of a persistent worker of the pool.
+*
+* The worker waits for a fork, runs the entry if its core belongs to the team and waits for the
+end of the fork, until the pool is stopped.
+*
+* @param data The core id of the worker
+*/
+
+static void *hostPoolMain(void *data)
+{
+    hostCoreId = (uint32_t)(uintptr_t)data;
+    hostPin(hostCoreId);
+    while (1) {
+        hostBarrierWait(&hostPool.dispatch);
+        if (hostPool.stop) {
+            return NULL;
+        }
+        if ((int)hostCoreId < hostPool.teamCores) {
+            hostTeamCores = hostPool.teamCores;
+            hostTeamBarrier = &hostPool.team;
+            hostPool.entry(hostPool.arg);
+            hostTeamBarrier = NULL;
+        }
+        hostBarrierWait(&hostPool.dispatch);
+    }
+}
+
+
+/**
+* @brief Start of the pool, with a worker for every core of the cluster but core 0.
+*/
+
+static void hostPoolStart(void)
+{
+    //With more cores than CPUs a spinning core only delays the one it waits for, so it sleeps at once
+    const char *env = getenv("PMSIS_HOST_SPIN");
+    if (env != NULL) {
+        hostSpin = atoi(env);
+    } else if (clusterCores > sysconf(_SC_NPROCESSORS_ONLN)) {
+        hostSpin = 0;
+    }
+    hostPool.cores = clusterCores;
+    hostPool.stop = 0;
+    hostBarrierInit(&hostPool.dispatch, clusterCores);
+    hostPin(0);
+    for (int i = 1; i < clusterCores; i++) {
+        if (pthread_create(&hostPool.threads[i], NULL, hostPoolMain, (void *)(uintptr_t)i)) {
+            fprintf(stderr, "pi_cl_team_fork: thread creation failed\n");
+            exit(-1);
+        }
+    }
+}
+
+
+/**
+* @brief Stop of the pool: the workers are released with the stop flag set, and joined.
+*/
+
+static void hostPoolStop(void)
+{
+    if (hostPool.cores == 0) {
+        return;
+    }
+    hostPool.stop = 1;
+    hostBarrierWait(&hostPool.dispatch);
+    for (int i = 1; i < hostPool.cores; i++) {
+        pthread_join(hostPool.threads[i], NULL);
+    }
+    hostPool.cores = 0;
+}
+
+
+void pi_cluster_conf_init(struct pi_cluster_conf *conf)
+{
+    conf->id = 0;
+}
+
+
+void pi_open_from_conf(struct pi_device *device, void *conf)
+{
+    device->config = conf;
+    device->data = NULL;
+}
+
+
+/**
+* @brief Opening of the emulated cluster.
+*
+* The number of cores is read from the environment variable PMSIS_HOST_NB_CORES if present,
+otherwise the compile time default is used.
+*
+* @param device The cluster device
+*/
+
+int pi_cluster_open(struct pi_device *device)
+{
+    const char *env = getenv("PMSIS_HOST_NB_CORES");
+    (void)device;
+    if (env != NULL) {
+        int cores = atoi(env);
+        if (cores < 1 || cores > PMSIS_HOST_MAX_CORES) {
+            fprintf(stderr, "PMSIS_HOST_NB_CORES must be between 1 and %d\n", PMSIS_HOST_MAX_CORES);
+            return -1;
+        }
+        clusterCores = cores;
+    }
+    return 0;
+}
+
+
+int pi_cluster_close(struct pi_device *device)
+{
+    (void)device;
+    hostPoolStop();
+    return 0;
+}
+
+
+struct pi_cluster_task *(pi_cluster_task)(struct pi_cluster_task *task, void (*entry)(void *), void *arg)
+{
+    task->entry = entry;
+    task->arg = arg;
+    return task;
+}
+
+
+/**
+* @brief Blocking offload of a task to the cluster.
+*
+* The task runs on the calling thread acting as the cluster master core,
+and the function returns when the task is finished, like on GAP8.
+*
+* @param device The cluster device
+* @param task The task to execute
+*/
+
+int pi_cluster_send_task_to_cl(struct pi_device *device, struct pi_cluster_task *task)
+{
+    uint32_t fcCoreId = hostCoreId;
+    (void)device;
+    hostCoreId = 0;
+    task->entry(task->arg);
+    hostCoreId = fcCoreId;
+    return 0;
+}
+
+
+/**
+* @brief Fork of a team of new threads, for a fork inside a team.
+*
+* Core 0 is the calling thread, the other cores are new threads. All of them share
+a barrier sized for the team, and the function returns only after every core has
+finished the entry.
+*/
+
+static void hostForkThreads(int nb_cores, void (*entry)(void *), void *arg)
+{
+    pthread_t threads[PMSIS_HOST_MAX_CORES];
+    HostWorker workers[PMSIS_HOST_MAX_CORES];
+    HostBarrier barrier;
+    int savedTeamCores = hostTeamCores;
+    HostBarrier *savedTeamBarrier = hostTeamBarrier;
+
+    hostBarrierInit(&barrier, nb_cores);
+
+    for (int i = 1; i < nb_cores; i++) {
+        workers[i].core_id = i;
+        workers[i].nb_cores = nb_cores;
+        workers[i].barrier = &barrier;
+        workers[i].entry = entry;
+        workers[i].arg = arg;
+        if (pthread_create(&threads[i], NULL, hostWorkerMain, &workers[i])) {
+            fprintf(stderr, "pi_cl_team_fork: thread creation failed\n");
+            exit(-1);
+        }
+    }
+
+    hostTeamCores = nb_cores;
+    hostTeamBarrier = &barrier;
+    entry(arg);
+
+    for (int i = 1; i < nb_cores; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    hostTeamCores = savedTeamCores;
+    hostTeamBarrier = savedTeamBarrier;
+}
+
+
+/**
+* @brief Fork of a team of cores.
+*
+* Core 0 is the calling thread, the other cores are the persistent workers of the pool,
+started at the first fork. The team barrier is sized for the team, and the function returns
+only after every core has finished the entry. A fork from inside a team creates its own threads.
+*
+* @param nb_cores Number of cores of the team, 0 means all the cores of the cluster
+* @param entry Function executed by every core
+* @param arg Argument passed to entry
+*/
+
+void (pi_cl_team_fork)(int nb_cores, void (*entry)(void *), void *arg)
+{
+    if (nb_cores <= 0 || nb_cores > clusterCores) {
+        nb_cores = clusterCores;
+    }
+    if (hostTeamBarrier != NULL) {
+        hostForkThreads(nb_cores, entry, arg);
+        return;
+    }
+    if (hostPool.cores != clusterCores) {
+        hostPoolStop();
+        hostPoolStart();
+    }
+    hostPool.entry = entry;
+    hostPool.arg = arg;
+    hostPool.teamCores = nb_cores;
+    hostBarrierInit(&hostPool.team, nb_cores);
+    hostBarrierWait(&hostPool.dispatch);
+
+    hostTeamCores = nb_cores;
+    hostTeamBarrier = &hostPool.team;
+    entry(arg);
+    hostTeamCores = 1;
+    hostTeamBarrier = NULL;
+
+    hostBarrierWait(&hostPool.dispatch);
+}
+
+
+void pi_cl_team_barrier(void)
+{
+    if (hostTeamBarrier != NULL) {
+        hostBarrierWait(hostTeamBarrier);
+    }
+}
+
+
+int pi_cl_team_nb_cores(void)
+{
+    return hostTeamCores;
+}
+
+
+uint32_t pi_cl_cluster_nb_cores(void)
+{
+    return (uint32_t)clusterCores;
+}
+
+
+uint32_t pi_core_id(void)
+{
+    return hostCoreId;
+}
+
+
+uint32_t pi_cluster_id(void)
+{
+    return 0;
+}
+
+
+void pi_cl_team_critical_enter(void)
+{
+    pthread_mutex_lock(&hostCritical);
+}
+
+
+void pi_cl_team_critical_exit(void)
+{
+    pthread_mutex_unlock(&hostCritical);
+}
+
+
+void *pi_l1_malloc(struct pi_device *device, size_t size)
+{
+    (void)device;
+    return malloc(size);
+}
+
+
+void pi_l1_free(struct pi_device *device, void *chunk, size_t size)
+{
+    (void)device;
+    (void)size;
+    free(chunk);
+}
+
+
+void *pi_l2_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+
+void pi_l2_free(void *chunk, size_t size)
+{
+    (void)size;
+    free(chunk);
+}
+
+
+void pi_cl_dma_memcpy(pi_cl_dma_copy_t *copy)
+{
+    if (copy->dir == PI_CL_DMA_DIR_EXT2LOC) {
+        memcpy((void *)copy->loc, (const void *)copy->ext, copy->size);
+    } else {
+        memcpy((void *)copy->ext, (const void *)copy->loc, copy->size);
+    }
+}
+
+
+void pi_cl_dma_wait(pi_cl_dma_copy_t *copy)
+{
+    (void)copy;
+}
+
+
+/**
+* @brief Entry of the PMSIS application.
+*
+* On host there is no operating system to start, we simply call the main function
+of the application, that is expected to terminate with pmsis_exit.
+*
+* @param arg Pointer to the void(void) main function of the application
+*/
+
+int pmsis_kickoff(void *arg)
+{
+    void (*entry)(void) = (void (*)(void))arg;
+    entry();
+    return 0;
+}
+
+
+void pmsis_exit(int err)
+{
+    fflush(stdout);
+    exit(err);
+}
@@ -8,14 +8,23 @@
  */
 #include "pmsis.h" 
 #include <stdio.h>
+#include <string.h>
 #include "parallelIzhi.h"
 #include <math.h>
 #include <time.h>
 #include <GapBuiltins.h>
-/** @brief Array of neurons in the first layer */
-Neuron firstLevel[neuronFirstLevel]; 
-/** @brief Array of neurons in the second layer */
-Neuron secondLevel[neuronSecondLevel];
+
+/* Every cluster core traces in its own buffer */
+#define traceCore() pi_core_id()
+#include "snnTrace.h"
+#include "snnPerf.h"
+#include "snnBench.h"
+#include "spikeSource.h"
+#include "partition.h"
+/** @brief Array of neurons in the first layer, a neuron for every sample of the batch */
+Neuron firstLevel[neuronFirstLevel * SNN_BATCH]; 
+/** @brief Array of neurons in the second layer, a neuron for every sample of the batch */
+Neuron secondLevel[neuronSecondLevel * SNN_BATCH];
 
 /**
 * Weights matrix for connections within the first level.
@@ -23,6 +32,23 @@ Neuron secondLevel[neuronSecondLevel];
 */
 int weightsFirstLevel[neuronFirstLevel][neuronFirstLevel];
 
+#if TIME_BATCH > 1
+/** @brief Weights of the first level transposed, a row of neuronFirstLevel weights for every input */
+int weightsFirstLevelInput[neuronFirstLevel][neuronFirstLevel];
+
+/** @brief Spikes of the primary inputs in the window, a row for every timestep and sample */
+int windowSpikes[TIME_BATCH * SNN_BATCH][neuronFirstLevel];
+
+/** @brief Frames of the window, the input of the first layer at every timestep */
+int windowFrames[TIME_BATCH][neuronFirstLevel * SNN_BATCH];
+
+/** @brief Input currents of the first layer in the window, a row for every timestep and sample */
+int windowCurrents[TIME_BATCH * SNN_BATCH][neuronFirstLevel];
+
+/** @brief Timesteps of the window, fewer than TIME_BATCH when the spike trains end */
+static int windowSteps;
+#endif
+
 
 /** 
  * Weights matrix for connections from the first level to the second level.
@@ -30,14 +56,11 @@ int weightsFirstLevel[neuronFirstLevel][neuronFirstLevel];
  */
  int weightsSecondLevel[neuronSecondLevel][neuronFirstLevel];
 
- /** @brief Input array for the first layer */
- int inputFirstLayer[neuronFirstLevel];
- 
  /** @brief Input array for the second layer */
- int inputSecondLayer[neuronFirstLevel];
+ int inputSecondLayer[neuronFirstLevel * SNN_BATCH];
  
  /** @brief Input array for the third layer */
- int inputThirdLayer[neuronSecondLevel];
+ int inputThirdLayer[neuronSecondLevel * SNN_BATCH];
  
  /** @brief Sample input sequence for neurons */
  int input[neuronFirstLevel][timestep] = {
@@ -50,37 +73,301 @@ int weightsFirstLevel[neuronFirstLevel][neuronFirstLevel];
          {0, 0}
      };
 
+ /**
+ * @brief Integration of the Izhikevich equations over a timestep of 1 ms.
+ *
+ * IZHI_SUBSTEPS forward Euler steps of 1/IZHI_SUBSTEPS ms; the integration stops when v reaches the threshold,
+ * the spike is then handled by the caller. With a single sub-step it is the original update.
+ *
+ * @param v Membrane potential, updated in place.
+ * @param u Recovery variable, updated in place.
+ * @param a Parameter 'a' of Izhikevich.
+ * @param b Parameter 'b' of Izhikevich.
+ * @param current The input current applied to the neuron.
+ */
+static inline void izhiIntegrate(potential_t* v, potential_t* u, potential_t a, potential_t b, int current) {
+    for (int step = 0; step < IZHI_SUBSTEPS; step++) {
+        if (IZHI_SUBSTEPS > 1 && *v >= POTENTIAL_FROM_DOUBLE(30)) {
+            break;
+        }
+#if NEURON_FIXED_POINT
+        fixed_izhi_substep(v, u, a, b, current, IZHI_SUBSTEP_SHIFT);
+#else
+        const double h = 1.0 / IZHI_SUBSTEPS;
+        double v_old = *v;
+        *v = v_old + h * (0.04 * v_old * v_old + 5 * v_old + 140 - *u + current);
+        *u = *u + h * (a * (b * v_old - *u));
+#endif
+    }
+}
+
+/**
+ * @brief Spike and reset of a neuron, after the integration.
+ *
+ * With IZHI_FAST_PATH the neuron is also marked at rest when the update, without current and without spike,
+ * moved its state by no more than IZHI_REST_TOLERANCE.
+ *
+ * @param n Pointer to the neuron, already integrated.
+ * @param index Index of the neuron and of the sample, numberNeuron * SNN_BATCH + sample.
+ * @param inputNextLayer Pointer to the input array of the next layer.
+ * @param current The input current applied to the neuron.
+ * @param v_old Membrane potential before the integration.
+ * @param u_old Recovery variable before the integration.
+ */
+static inline void izhiSpike(Neuron* n, int index, int* inputNextLayer, int current, potential_t v_old, potential_t u_old) {
+    if (n->potential >= POTENTIAL_FROM_DOUBLE(30)) { // 30mV threshold voltage for Izhikevich
+        n->spiked = 1;
+        inputNextLayer[index] = 1; 
+        n->potential = n->c;              // Potential reset
+        n->u += n->d;                     //Update of the recovery value
+    } else {
+        n->spiked = 0;
+    }
+#if IZHI_FAST_PATH
+    potential_t tolerance = POTENTIAL_FROM_DOUBLE(IZHI_REST_TOLERANCE);
+    n->resting = current == 0 && !n->spiked
+              && n->potential - v_old <= tolerance && v_old - n->potential <= tolerance
+              && n->u - u_old <= tolerance && u_old - n->u <= tolerance;
+#else
+    (void)current; (void)v_old; (void)u_old;
+#endif
+}
+
+/**
+ * @brief Debugging output of the update of a neuron, compiled only at the TRACE_NEURON level.
+ *
+ * @param n Pointer to the neuron.
+ * @param index Index of the neuron and of the sample, numberNeuron * SNN_BATCH + sample.
+ */
+static inline void izhiTrace(const Neuron* n, int index) {
+#if SNN_BATCH == 1
+    traceNeuron(traceNow.step, traceNow.layer, index, POTENTIAL_TO_TRACE(n->potential), n->spiked,
+           "Neuron -> %d, potential: %.2f, recovery: %.2f, spiked: %d\n",
+           index, POTENTIAL_TO_DOUBLE(n->potential), POTENTIAL_TO_DOUBLE(n->u), n->spiked);
+#else
+    traceNeuron(traceNow.step, traceNow.layer, index, POTENTIAL_TO_TRACE(n->potential), n->spiked,
+           "Neuron -> %d, sample %d, potential: %.2f, recovery: %.2f, spiked: %d\n",
+           index / SNN_BATCH, index % SNN_BATCH, POTENTIAL_TO_DOUBLE(n->potential), POTENTIAL_TO_DOUBLE(n->u), n->spiked);
+#endif
+    (void)n; (void)index;
+}
+
  /**
  * @brief Updates a single neuron's state based on the Izhikevich model.
  * 
  * This function computes the membrane potential and recovery variable for 
- * a neuron using the Izhikevich differential equations. It also determines 
- * whether the neuron has spiked.
+ * a neuron using the Izhikevich differential equations (see izhiIntegrate). It also determines 
+ * whether the neuron has spiked. With IZHI_FAST_PATH a neuron at rest without current is skipped.
  * 
  * @param n Pointer to the neuron to update.
  * @param numberNeuron Index of the neuron in the layer.
+ * @param sample Sample of the batch.
  * @param inputNextLayer Pointer to the input array of the next layer.
- * @param current The input current applied to the neuron.
+ * @param current The input current applied to the neuron, the sum of the integer weights of the active inputs.
  */
-void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer, double current) {
+void update_neuron(Neuron* n, int numberNeuron, int sample, int* inputNextLayer, int current) {
+    int index = numberNeuron * SNN_BATCH + sample;
+#if IZHI_FAST_PATH
+    if (n->resting && current == 0) {
+        n->spiked = 0;
+        izhiTrace(n, index);
+        return;
+    }
+#endif
+    potential_t v_old = n->potential, u_old = n->u;
+    izhiIntegrate(&n->potential, &n->u, n->a, n->b, current);
+    izhiSpike(n, index, inputNextLayer, current, v_old, u_old);
+    izhiTrace(n, index);
+}
 
-    //Computation of the Izhikevich differential equations
-    double v_old = n->potential; 
-    n->potential += 0.04 * v_old * v_old + 5 * v_old + 140 - n->u + current;
-    n->u += n->a * (n->b * v_old - n->u);
 
-    if (n->potential >= 30) { // 30mV threshold voltage for Izhikevich
-        n->spiked = 1;
-        inputNextLayer[numberNeuron] = 1; 
-        n->potential = n->c;              // Potential reset
-        n->u += n->d;                     //Update of the recovery value
-    } else {
-        n->spiked = 0;
+#if IZHI_VECTOR
+#if NEURON_FIXED_POINT
+/** @brief Vector of the wide intermediates of the fixed-point integration, a lane for every neuron */
+typedef fixed_wide_t izhiVector __attribute__((vector_size(izhiLanes * sizeof(fixed_wide_t))));
+#else
+/** @brief Vector of potentials, a lane for every neuron */
+typedef double izhiVector __attribute__((vector_size(izhiLanes * sizeof(double))));
+/** @brief Mask of the lanes of an izhiVector, all ones in a selected lane */
+typedef int64_t izhiMask __attribute__((vector_size(izhiLanes * sizeof(double))));
+#endif
+
+/**
+ * @brief Vector update of izhiLanes consecutive neurons.
+ *
+ * The state and the parameters of the neurons are gathered in vectors, the sub-steps of izhiIntegrate are
+ * computed on all the lanes at once, and the lanes that reached the threshold are frozen by a mask until
+ * the end of the timestep. The spikes are then handled lane by lane by izhiSpike. In fixed-point the
+ * lanes are on the wide type and saturated as in fixed_izhi_substep, so the result is the one of update_neuron.
+ * With IZHI_FAST_PATH the lanes at rest without current are frozen by a mask, as update_neuron skips
+ * them, and a vector of neurons all at rest and without current is skipped.
+ *
+ * @param layer Pointer to the layer instantiation containing neurons and outputs.
+ * @param first Index of the first neuron and sample, numberNeuron * SNN_BATCH + sample.
+ * @param current Input currents of the izhiLanes neurons.
+ */
+static inline void izhiUpdateVector(LayerInstanziation* layer, int first, const int* current) {
+    Neuron* n = &layer->neuronLayer[first];
+#if IZHI_FAST_PATH
+    int resting = 1;
+    for (int k = 0; k < izhiLanes; k++) {
+        resting &= n[k].resting && current[k] == 0;
+    }
+    if (resting) {
+        for (int k = 0; k < izhiLanes; k++) {
+            n[k].spiked = 0;
+            izhiTrace(&n[k], first + k);
+        }
+        return;
+    }
+#endif
+    izhiVector v, u, a, b, input;
+    for (int k = 0; k < izhiLanes; k++) {
+        v[k] = n[k].potential;
+        u[k] = n[k].u;
+        a[k] = n[k].a;
+        b[k] = n[k].b;
+        input[k] = current[k];
+    }
+    izhiVector v_start = v, u_start = u;
+#if IZHI_FAST_PATH
+#if NEURON_FIXED_POINT
+    izhiVector frozen;
+#else
+    izhiMask frozen;
+#endif
+    for (int k = 0; k < izhiLanes; k++) {
+        frozen[k] = n[k].resting && current[k] == 0 ? -1 : 0;
     }
+#endif
+    for (int step = 0; step < IZHI_SUBSTEPS; step++) {
+        izhiVector v_old = v, u_old = u;
+#if NEURON_FIXED_POINT
+        izhiVector v2 = (v_old * v_old) >> FIXED_FRAC_BITS;
+        izhiVector dv = FIXED_IZHI_QUADRATIC(v2) + 5 * v_old + 140 * FIXED_ONE - u_old + input * FIXED_ONE;
+        izhiVector du = (a * (((b * v_old) >> FIXED_FRAC_BITS) - u_old)) >> FIXED_FRAC_BITS;
+        v = v_old + (dv >> IZHI_SUBSTEP_SHIFT);
+        u = u_old + (du >> IZHI_SUBSTEP_SHIFT);
+        izhiVector high = v > FIXED_MAX, low = v < FIXED_MIN;
+        v = (v & ~(high | low)) | (FIXED_MAX & high) | (FIXED_MIN & low);
+        high = u > FIXED_MAX;
+        low = u < FIXED_MIN;
+        u = (u & ~(high | low)) | (FIXED_MAX & high) | (FIXED_MIN & low);
+#else
+        const double h = 1.0 / IZHI_SUBSTEPS;
+        v = v_old + h * (0.04 * v_old * v_old + 5 * v_old + 140 - u_old + input);
+        u = u_old + h * (a * (b * v_old - u_old));
+#endif
+        if (IZHI_SUBSTEPS > 1) {
+            //The lanes already over the threshold keep their state
+#if NEURON_FIXED_POINT
+            izhiVector spiked = v_old >= POTENTIAL_FROM_DOUBLE(30);
+            v = (v & ~spiked) | (v_old & spiked);
+            u = (u & ~spiked) | (u_old & spiked);
+#else
+            izhiMask spiked = v_old >= 30.0;
+            v = (izhiVector)(((izhiMask)v & ~spiked) | ((izhiMask)v_old & spiked));
+            u = (izhiVector)(((izhiMask)u & ~spiked) | ((izhiMask)u_old & spiked));
+#endif
+        }
+    }
+#if IZHI_FAST_PATH
+    //The lanes at rest keep their state, so izhiSpike finds them at rest again without a spike
+#if NEURON_FIXED_POINT
+    v = (v & ~frozen) | (v_start & frozen);
+    u = (u & ~frozen) | (u_start & frozen);
+#else
+    v = (izhiVector)(((izhiMask)v & ~frozen) | ((izhiMask)v_start & frozen));
+    u = (izhiVector)(((izhiMask)u & ~frozen) | ((izhiMask)u_start & frozen));
+#endif
+#endif
+    for (int k = 0; k < izhiLanes; k++) {
+        n[k].potential = v[k];
+        n[k].u = u[k];
+        izhiSpike(&n[k], first + k, layer->output, current[k], v_start[k], u_start[k]);
+        izhiTrace(&n[k], first + k);
+    }
+}
+#endif
 
-    // Debugging output
-    printf("Neuron -> %d, potential: %.2f, recovery: %.2f, spiked: %d\n",
-           numberNeuron, n->potential, n->u, n->spiked);
+/**
+ * @brief Update of a run of neurons, given their input currents.
+ *
+ * The neurons and samples [first,first+count), indexed numberNeuron * SNN_BATCH + sample, are updated by
+ * the vector kernel izhiLanes at a time, and the remaining ones by update_neuron.
+ *
+ * @param layer Pointer to the layer instantiation containing neurons and outputs.
+ * @param first Index of the first neuron and sample.
+ * @param count Number of neurons and samples.
+ * @param current Input current of every neuron and sample of the run.
+ */
+static void updateNeurons(LayerInstanziation* layer, int first, int count, const int* current) {
+    int k = 0;
+#if IZHI_VECTOR
+    for (; k + izhiLanes <= count; k += izhiLanes) {
+        izhiUpdateVector(layer, first + k, current + k);
+    }
+#endif
+    for (; k < count; k++) {
+        int index = first + k;
+        update_neuron(&layer->neuronLayer[index], index / SNN_BATCH, index % SNN_BATCH, layer->output, current[k]);
+    }
+}
+
+
+/**
+ * @brief Number of neurons whose currents are accumulated before they are updated together.
+ */
+#define izhiBlock 64
+
+/**
+ * @brief Input currents of a neuron for all the samples of the batch.
+ *
+ * The weight of every input is loaded once and added to the current of every sample in which the
+ * input spiked.
+ *
+ * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
+ * @param num_inputs Number of input connections to be processed.
+ * @param weights Weights of the neuron, one for every input.
+ * @param input_current Current of every sample, written.
+ */
+static inline void accumulateNeuron(LayerInstanziation* layer, int num_inputs, const int* weights, int* input_current) {
+    for (int sample = 0; sample < SNN_BATCH; sample++) {
+        input_current[sample] = 0;
+    }
+    for (int j = 0; j < num_inputs; j++) {
+        const int* spikes = layer->input + j * SNN_BATCH;
+        int weight = weights[j];
+        for (int sample = 0; sample < SNN_BATCH; sample++) {
+            if (spikes[sample] == 1) {
+                input_current[sample] = input_current[sample] + weight;
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief Simulates a range of neurons for all the samples of the batch.
+ *
+ * The currents of izhiBlock neurons at a time are accumulated by accumulateNeuron, then the
+ * neurons of the block are updated together by updateNeurons.
+ *
+ * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
+ * @param begin First neuron of the range.
+ * @param end Neuron after the last of the range.
+ * @param num_inputs Number of input connections to be processed.
+ * @param weights Weights matrix of the layer, a row for every neuron.
+ */
+static void simulateNeurons(LayerInstanziation* layer, int begin, int end, int num_inputs, int weights[][num_inputs]) {
+    int input_current[izhiBlock * SNN_BATCH];
+    for (int block = begin; block < end; block += izhiBlock) {
+        int last = block + izhiBlock < end ? block + izhiBlock : end;
+        for (int neuronNumber = block; neuronNumber < last; neuronNumber++) {
+            accumulateNeuron(layer, num_inputs, weights[neuronNumber], &input_current[(neuronNumber - block) * SNN_BATCH]);
+        }
+        updateNeurons(layer, block * SNN_BATCH, (last - block) * SNN_BATCH, input_current);
+    }
 }
 
 
@@ -89,30 +376,37 @@ void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer, double curr
  *
  * This function iterates over the neurons of the first layer assigned to the current core,
  * computes the input current based on incoming spikes and corresponding weights, and updates
- * the neuron's state by calling update_neuron.
+ * the neuron's state, for every sample of the batch, by calling simulateNeurons.
+ * With TIME_BATCH > 1 the currents of the timestep have been computed with the whole window
+ * (see windowProduct), so only the neurons are updated.
  *
  * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
- * @param core_id Identifier for the current processing core.
- * @param iteration Current iteration number in the simulation.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
  * @param num_inputs Number of input connections to be processed.
  */
 
-void simulateFirstLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            double input_current=0.0;
-            for (int j = 0; j < num_inputs; j++) {
-                //printf("%d\n",layer->input[j]);
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    input_current=input_current+weightsFirstLevel[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
+void simulateFirstLayer(LayerInstanziation* layer,int begin,int end,int num_inputs) {
+#if TIME_BATCH > 1
+    (void)num_inputs;
+#if SNN_BATCH == 1
+    updateNeurons(layer, begin, end - begin, layer->current + begin);
+#else
+    //The currents are stored by sample, they are gathered by neuron for the update
+    int input_current[izhiBlock * SNN_BATCH];
+    for (int block = begin; block < end; block += izhiBlock) {
+        int last = block + izhiBlock < end ? block + izhiBlock : end;
+        for (int neuronNumber = block; neuronNumber < last; neuronNumber++) {
+            for (int sample = 0; sample < SNN_BATCH; sample++) {
+                input_current[(neuronNumber - block) * SNN_BATCH + sample] = layer->current[sample * layer->neuronNumber + neuronNumber];
             }
-            update_neuron(&(layer->neuronLayer[neuronNumber]), neuronNumber, layer->output,input_current);
+        }
+        updateNeurons(layer, block * SNN_BATCH, (last - block) * SNN_BATCH, input_current);
     }
+#endif
+#else
+    simulateNeurons(layer, begin, end, num_inputs, weightsFirstLevel);
+#endif
 }
 
 /**
@@ -123,64 +417,52 @@ void simulateFirstLayer(LayerInstanziation* layer,int core_id,int iteration,int
  * then updates the neuron's state.
  *
  * @param layer Pointer to the layer instantiation containing neurons, inputs, number of inputs neuron number and outputs.
- * @param core_id Identifier for the current processing core.
- * @param iteration Current iteration number in the simulation.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
  * @param num_inputs Number of input connections to be processed.
  */
 
-void simulateSecondLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            double input_current=0.0;
-            for (int j = 0; j < num_inputs; j++) {
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    input_current=input_current+weightsSecondLevel[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
-            }
-            update_neuron(&(layer->neuronLayer[neuronNumber]),neuronNumber, layer->output,input_current);
-    }
+void simulateSecondLayer(LayerInstanziation* layer,int begin,int end,int num_inputs) {
+    simulateNeurons(layer, begin, end, num_inputs, weightsSecondLevel);
 }
 
 /**
  * @brief Initializes a neuron in the given layer.
  *
  * This function sets the initial state of a neuron by initializing its membrane potential,
- * recovery variable, model parameters (a, b, c, d), and the number of inputs. The neuron is
- * selected based on the current core and iteration.
+ * recovery variable, model parameters (a, b, c, d), and the number of inputs, for every
+ * neuron of the range of the current core.
  *
- * @param core_id Identifier of the processing core initializing the neuron.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
  * @param a Parameter 'a' of the Izhikevich neuron model.
  * @param b Parameter 'b' of the Izhikevich neuron model.
  * @param c Reset value for the membrane potential after a spike.
  * @param d Increment to the recovery variable after a spike.
  * @param initialPotential Initial membrane potential for the neuron.
- * @param iteration Current iteration number of the simulation.
  * @param layer Pointer to the layer instantiation containing the neuron array.
  * @param num_inputs Number of input connections for the neuron.
  */
 
-void initializeNeuron(int core_id, double a, double b, double c, double d, double initialPotential, int iteration, LayerInstanziation* layer,int num_inputs) {
-        int iterationNumber=gap_muls(iteration,8);
-        int neuron_index=gap_addnormu(core_id,iterationNumber,0);
-        if(core_id+iteration*8< layer->neuronNumber){
-            layer->neuronLayer[neuron_index].potential = initialPotential; // initial potential (v)
-            layer->neuronLayer[neuron_index].u = b * initialPotential;     // recovery variable (u)
-            layer->neuronLayer[neuron_index].a = a;                       // 'a' parameter'
-            layer->neuronLayer[neuron_index].b = b;                       // 'b' parameter'
-            layer->neuronLayer[neuron_index].c = c;                       // potential reset
-            layer->neuronLayer[neuron_index].d = d;                       // increment of u after the spike
+void initializeNeuron(int begin, int end, double a, double b, double c, double d, double initialPotential, LayerInstanziation* layer,int num_inputs) {
+        //Every sample of the batch has its own copy of the neuron
+        for(int neuron_index=begin*SNN_BATCH;neuron_index<end*SNN_BATCH;neuron_index++){
+            layer->neuronLayer[neuron_index].potential = POTENTIAL_FROM_DOUBLE(initialPotential); // initial potential (v)
+            layer->neuronLayer[neuron_index].u = POTENTIAL_FROM_DOUBLE(b * initialPotential);     // recovery variable (u)
+            layer->neuronLayer[neuron_index].a = POTENTIAL_FROM_DOUBLE(a);                       // 'a' parameter'
+            layer->neuronLayer[neuron_index].b = POTENTIAL_FROM_DOUBLE(b);                       // 'b' parameter'
+            layer->neuronLayer[neuron_index].c = POTENTIAL_FROM_DOUBLE(c);                       // potential reset
+            layer->neuronLayer[neuron_index].d = POTENTIAL_FROM_DOUBLE(d);                       // increment of u after the spike
             layer->neuronLayer[neuron_index].spiked = false;              // no spike initially
+            layer->neuronLayer[neuron_index].resting = 0;                 // updated until it reaches the rest
             layer->neuronLayer[neuron_index].num_inputs = num_inputs;             
             // Debugging
-            printf("Neuron number %d instanziate by core %d\n", neuron_index, core_id);
-            printf("Potential: %f, Recovery: %f, Parameters (a, b, c, d): (%f, %f, %f, %f)\n",
-                    layer->neuronLayer[neuron_index].potential, layer->neuronLayer[neuron_index].u,
-                    layer->neuronLayer[neuron_index].a, layer->neuronLayer[neuron_index].b,
-                    layer->neuronLayer[neuron_index].c, layer->neuronLayer[neuron_index].d);
+            traceNeuron(-1, traceNow.layer, neuron_index, POTENTIAL_TO_TRACE(layer->neuronLayer[neuron_index].potential), 0,
+                    "Neuron number %d instanziate by core %d\nPotential: %f, Recovery: %f, Parameters (a, b, c, d): (%f, %f, %f, %f)\n",
+                    neuron_index, (int)pi_core_id(),
+                    POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].potential), POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].u),
+                    POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].a), POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].b),
+                    POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].c), POTENTIAL_TO_DOUBLE(layer->neuronLayer[neuron_index].d));
         }
 }
 
@@ -188,43 +470,38 @@ void initializeNeuron(int core_id, double a, double b, double c, double d, doubl
 /**
  * @brief Initializes the output for a neuron in the layer.
  *
- * This function sets the output value of a neuron to zero for a given core and iteration.
+ * This function sets the output value of the neurons of the range of the current core to zero,
+ * for every sample of the batch.
  *
  * @param layer Pointer to the layer instantiation containing the output array.
- * @param core_id Identifier of the processing core.
- * @param iteration Current iteration number of the simulation.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
  */
 
-void init_output( LayerInstanziation* layer,int core_id,int iteration) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
+void init_output( LayerInstanziation* layer,int begin,int end) {
+    for(int neuronNumber=begin*SNN_BATCH;neuronNumber<end*SNN_BATCH;neuronNumber++){
         layer->output[neuronNumber]=0;
-        //printf("Output fissato a %d da core %d\n",layer->output[core_id],core_id);
     }
 }
 
 /**
  * @brief Initializes the weights for the connections of a neuron.
  *
- * This function assigns a weight value for each input connection of a neuron, using a simple
- * function based on the core identifier. The weights matrix is updated for the neuron selected
- * based on the core and iteration.
+ * This function assigns a weight value for each input connection of the neurons of the range,
+ * using a simple function of the neuron index: the core that initialized the neuron when the
+ * neurons were distributed round-robin on the eight cores, plus 3.
  *
- * @param layer Pointer to the layer instantiation containing the neuron array.
- * @param core_id Identifier of the processing core.
- * @param iteration Current iteration number of the simulation.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
  * @param input Number of input connections for the neuron.
  * @param weights 2D array representing the weights for the neuron's connections.
  */
 
 
-void initialize_weights(LayerInstanziation* layer, int core_id, int iteration,int input,int weights[][input]){
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
+void initialize_weights(int begin, int end,int input,int weights[][input]){
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
         for(int i=0;i<input;i++){
-            int randomInRange = core_id+3;
+            int randomInRange = neuronNumber%8+3;
             /*int random_value = pi_rand();  // PULP function to generate a number on 32 bits.
 
             //Random value between -5 and 5
@@ -240,113 +517,258 @@ void initialize_weights(LayerInstanziation* layer, int core_id, int iteration,in
  * @brief Cluster-level instantiation of neurons.
  *
  * This function is executed by the cluster cores and initializes neurons in the provided layer.
- * It iterates over the neurons (in chunks of 8) and calls the initializeNeuron function with standard
- * Izhikevich parameters.
+ * Every core calls the initializeNeuron function with standard Izhikevich parameters on a contiguous
+ * range of the neurons (see partition.h).
  *
  * @param layer Pointer to the layer instantiation containing the neurons to be initialized.
  */
 
 void cluster_neuronInstanziation(LayerInstanziation* layer) 
 { 
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();
-    uint32_t iteration = 0;
-    while(layer->neuronNumber>iteration*8){
-        //standard value for Izhikevich  
-        initializeNeuron(core_id, 0.02, 0.2, -65.0, 8.0, -65.0, iteration, layer, layer->num_inputs);
-        iteration++;
-    }
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+    //standard value for Izhikevich  
+    initializeNeuron(range.begin, range.end, 0.02, 0.2, -65.0, 8.0, -65.0, layer, layer->num_inputs);
+    perfEnd(PERF_INIT,&sample);
 } 
 
 /**
  * @brief Cluster-level instantiation of neuron outputs.
  *
  * This function is executed by the cluster cores and initializes the output array of each neuron in the
- * provided layer to zero. It processes neurons in chunks based on the iteration index.
+ * provided layer to zero. Every core processes a contiguous range of the neurons.
  *
  * @param layer Pointer to the layer instantiation containing the outputs to be initialized.
  */
 void cluster_outputInstanziation(LayerInstanziation* layer) 
 { 
-    uint32_t iteration =0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    while(layer->neuronNumber>iteration*8){ 
-        init_output(layer,core_id,iteration);
-        iteration++;
-    }
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+    init_output(layer,range.begin,range.end);
+    perfEnd(PERF_OUTPUT,&sample);
 } 
 /**
  * @brief Cluster-level instantiation of weights for the first layer.
  *
  * This function is executed by the cluster cores and initializes the weights for the neurons in the first layer.
- * It calls the initialize_weights function for each neuron (in chunks of 8) to set up the synaptic weights.
+ * Every core calls the initialize_weights function on a contiguous range of the neurons to set up the synaptic weights.
+ * With TIME_BATCH > 1 every core also writes its neurons in the transposed weights used by windowProduct.
  *
  * @param layer Pointer to the layer instantiation containing the neurons and weights to be initialized.
  */
 
 void cluster_weightsInstanziationFirstLayer(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();  
-    while(layer->neuronNumber>iteration*8){
-        initialize_weights(layer,core_id,iteration,layer->num_inputs,weightsFirstLevel);
-        iteration++;
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+    initialize_weights(range.begin,range.end,layer->num_inputs,weightsFirstLevel);
+#if TIME_BATCH > 1
+    for(int neuronNumber=range.begin;neuronNumber<range.end;neuronNumber++){
+        for(int i=0;i<layer->num_inputs;i++){
+            weightsFirstLevelInput[i][neuronNumber]=weightsFirstLevel[neuronNumber][i];
+        }
     }
+#endif
+    perfEnd(PERF_INIT,&sample);
 } 
 
 /**
  * @brief Cluster-level instantiation of weights for the second layer.
  *
  * This function is executed by the cluster cores and initializes the weights for the neurons in the second layer.
- * It iterates over the neurons (in chunks of 8) and calls the initialize_weights function to set up the synaptic weights.
+ * Every core calls the initialize_weights function on a contiguous range of the neurons to set up the synaptic weights.
  *
  * @param layer Pointer to the layer instantiation containing the neurons and weights to be initialized.
  */
 
 void cluster_weightsInstanziationSecondLayer(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();  
-    while(layer->neuronNumber>iteration*8){
-        initialize_weights(layer,core_id,iteration,layer->num_inputs,weightsSecondLevel);
-        iteration++;
-    }
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+    initialize_weights(range.begin,range.end,layer->num_inputs,weightsSecondLevel);
+    perfEnd(PERF_INIT,&sample);
 } 
 
+#if TIME_BATCH > 1
+/** @brief Neurons of a block of the window product, the currents of a row of the block stay in registers or L1 */
+#define windowNeuronBlock 64
+
+/** @brief Inputs of a block of the window product, the weights of a block stay in cache for all the rows */
+#define windowInputBlock 128
+
+/**
+ * @brief Input currents of a range of neurons of the first layer for all the timesteps of the window.
+ *
+ * The currents are the product windowSpikes x weightsFirstLevelInput, for the columns of the neurons
+ * [begin,end). The product is blocked on the neurons and on the inputs, so a block of weights is loaded
+ * once and used by every timestep and sample of the window, and the inner loop adds a contiguous row of
+ * weights to a contiguous row of currents, which is vectorized. The inputs that didn't spike are skipped.
+ *
+ * @param rows Rows of the window, its timesteps times SNN_BATCH.
+ * @param begin First neuron of the range of the core.
+ * @param end Neuron after the last of the range of the core.
+ */
+static void windowProduct(int rows, int begin, int end)
+{
+    for (int r = 0; r < rows; r++) {
+        for (int n = begin; n < end; n++) {
+            windowCurrents[r][n] = 0;
+        }
+    }
+    for (int n0 = begin; n0 < end; n0 += windowNeuronBlock) {
+        int n1 = n0 + windowNeuronBlock < end ? n0 + windowNeuronBlock : end;
+        for (int k0 = 0; k0 < neuronFirstLevel; k0 += windowInputBlock) {
+            int k1 = k0 + windowInputBlock < neuronFirstLevel ? k0 + windowInputBlock : neuronFirstLevel;
+            for (int r = 0; r < rows; r++) {
+                int* currents = windowCurrents[r];
+                const int* spikes = windowSpikes[r];
+                for (int k = k0; k < k1; k++) {
+                    if (spikes[k] == 1) {
+                        const int* weights = weightsFirstLevelInput[k];
+                        for (int n = n0; n < n1; n++) {
+                            currents[n] = currents[n] + weights[n];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Cluster-level computation of the first layer currents of the window.
+ *
+ * This function is executed by the cluster cores when a window of timesteps starts. Every core computes
+ * the currents of a contiguous range of the neurons, of whole cache lines of currents, for all the rows of the window.
+ *
+ * @param layer Pointer to the first layer instantiation.
+ */
+void cluster_windowFirstLayer(LayerInstanziation* layer)
+{
+    Range range=partitionCore(layer->neuronNumber,16);
+    PerfSample sample;
+    perfBegin(&sample);
+    windowProduct(windowSteps*SNN_BATCH,range.begin,range.end);
+    perfEnd(perfLayer(0),&sample);
+}
+#endif
+
+#if SPLIT_REDUCTION
+/** @brief Partial input currents of the split accumulation, a row for every core */
+static int splitPartial[partitionMaxCores][SPLIT_MAX_NEURONS * SNN_BATCH];
+
+/**
+ * @brief Simulates a narrow layer with the synaptic accumulation split among the cores.
+ *
+ * Every core accumulates, for every neuron of the layer and every sample of the batch, the current
+ * of its slice of the inputs in its row of splitPartial. After a barrier, every core adds up the rows for the neurons of its range
+ * and updates them. All the cores of the team must call it.
+ *
+ * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
+ * @param range Neurons updated by the core.
+ * @param num_inputs Number of input connections to be processed.
+ * @param weights Weights matrix of the layer.
+ */
+static void simulateSplitLayer(LayerInstanziation* layer, Range range, int num_inputs, int weights[][num_inputs])
+{
+    int core_id = pi_core_id();
+    int cores = pi_cl_cluster_nb_cores();
+    Range inputs = partitionStatic(num_inputs, core_id, cores, 1);
+    for (int neuronNumber = 0; neuronNumber < layer->neuronNumber; neuronNumber++) {
+        int* partial = &splitPartial[core_id][neuronNumber * SNN_BATCH];
+        for (int sample = 0; sample < SNN_BATCH; sample++) {
+            partial[sample] = 0;
+        }
+        for (int j = inputs.begin; j < inputs.end; j++) {
+            const int* spikes = layer->input + j * SNN_BATCH;
+            for (int sample = 0; sample < SNN_BATCH; sample++) {
+                if (spikes[sample] == 1) {
+                    partial[sample] = partial[sample] + weights[neuronNumber][j];
+                }
+            }
+        }
+    }
+    pi_cl_team_barrier();
+    //The currents of the range are summed in the row of the core, whose entries of the range only the core reads
+    int* input_current = &splitPartial[core_id][range.begin * SNN_BATCH];
+    for (int index = range.begin * SNN_BATCH; index < range.end * SNN_BATCH; index++) {
+        int sum = 0;
+        for (int c = 0; c < cores; c++) {
+            sum = sum + splitPartial[c][index];
+        }
+        input_current[index - range.begin * SNN_BATCH] = sum;
+    }
+    updateNeurons(layer, range.begin * SNN_BATCH, (range.end - range.begin) * SNN_BATCH, input_current);
+}
+#endif
+
 /**
  * @brief Cluster-level simulation of the first layer.
  *
  * This function is executed by the cluster cores and simulates the activity of the first layer of neurons.
- * It iterates over the neurons in chunks of 8 and updates their state based on the inputs and synaptic weights.
+ * Every core updates the state of a contiguous range of the neurons based on the inputs and synaptic weights.
+ * When the layer is too narrow for the cores (see partitionSplit), the cores share the inputs instead,
+ * unless the currents have been computed with the window.
  *
  * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
  */
 
 void cluster_simulationFirstLayer(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();  
-    while(layer->neuronNumber>iteration*8){
-        //printf("%d\n",layer->input[0]);
-        simulateFirstLayer(layer,core_id,iteration,layer->num_inputs);
-        iteration++;
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+#if SPLIT_REDUCTION && TIME_BATCH == 1
+    if(partitionSplit(layer->neuronNumber,layer->num_inputs,pi_cl_cluster_nb_cores(),1)){
+        simulateSplitLayer(layer,range,layer->num_inputs,weightsFirstLevel);
+    }else
+#endif
+    {
+        simulateFirstLayer(layer,range.begin,range.end,layer->num_inputs);
     }
+#if SNN_BENCH
+    int spikes=0;
+    for(int n=range.begin*SNN_BATCH;n<range.end*SNN_BATCH;n++){
+        spikes+=layer->output[n];
+    }
+    benchSpikesAdd(pi_core_id(),1,spikes);
+#endif
+    perfEnd(perfLayer(0),&sample);
 } 
 /**
  * @brief Cluster-level simulation of the second layer.
  *
  * This function is executed by the cluster cores and simulates the activity of the second layer of neurons.
- * It iterates over the neurons in chunks of 8 and updates their state based on the inputs and synaptic weights.
+ * Every core updates the state of a contiguous range of the neurons based on the inputs and synaptic weights.
+ * When the layer is too narrow for the cores (see partitionSplit), the cores share the inputs instead.
  *
  * @param layer Pointer to the layer instantiation containing neurons, inputs, and outputs.
  */
 void cluster_simulationSecondLayer(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();  
-    while(layer->neuronNumber>iteration*8){
-        simulateSecondLayer(layer,core_id,iteration,layer->num_inputs);
-        iteration++;
+    Range range=partitionCore(layer->neuronNumber,1);
+    PerfSample sample;
+    perfBegin(&sample);
+#if SPLIT_REDUCTION
+    if(partitionSplit(layer->neuronNumber,layer->num_inputs,pi_cl_cluster_nb_cores(),1)){
+        simulateSplitLayer(layer,range,layer->num_inputs,weightsSecondLevel);
+    }else
+#endif
+    {
+        simulateSecondLayer(layer,range.begin,range.end,layer->num_inputs);
+    }
+#if SNN_BENCH
+    int spikes=0;
+    for(int n=range.begin*SNN_BATCH;n<range.end*SNN_BATCH;n++){
+        spikes+=layer->output[n];
     }
+    benchSpikesAdd(pi_core_id(),2,spikes);
+#endif
+    perfEnd(perfLayer(1),&sample);
 } 
 
 
@@ -441,13 +863,134 @@ void cluster_simulationSecondLayer(LayerInstanziation* layer)
 }  
 
 
+#if TIME_BATCH > 1
+/**
+ * @brief Main cluster entry point for the first layer currents of a window.
+ *
+ * This function is executed by core 0 and dispatches the window product to all cluster cores.
+ * It calls the cluster_windowFirstLayer function on each core.
+ *
+ * @param layer Pointer to the first layer instantiation.
+ */
+  void cluster_delegate7(LayerInstanziation* layer) 
+{  
+    /* Task dispatch to cluster cores. */ 
+    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_windowFirstLayer, layer);
+}  
+#endif
+
+
+/**
+ * @brief Source of the primary inputs of a sample of the batch.
+ *
+ * On host, the environment variable SNN_INPUT can give a file of spikes (see spikeSource.h), or a list
+ * of files separated by ':' that the samples take in turn, otherwise the source is the input table,
+ * converted in a ring of frames one block at a time. The frames are not bit-packed, one int for every input.
+ *
+ * @param sample Sample of the batch
+ * @return The source, or NULL on error
+ */
+SpikeSource* inputSource(int sample)
+{
+#if SPIKE_FILE_SOURCE
+    static SpikeFileSource file[SNN_BATCH];
+    const char* paths=getenv("SNN_INPUT");
+    if(paths!=NULL){
+        int count=1;
+        for(const char* p=paths;*p;p++){
+            count+=*p==':';
+        }
+        //Path of the sample, the (sample % count)-th of the list
+        for(int skip=sample%count;skip>0;skip--){
+            paths=strchr(paths,':')+1;
+        }
+        char path[256];
+        size_t length=strchr(paths,':')!=NULL ? (size_t)(strchr(paths,':')-paths) : strlen(paths);
+        if(length>=sizeof(path)){
+            return NULL;
+        }
+        memcpy(path,paths,length);
+        path[length]='\0';
+        return spikeFileOpen(&file[sample],path,neuronFirstLevel,0) ? NULL : &file[sample].source;
+    }
+#endif
+    static SpikeTableProducer table[SNN_BATCH];
+    static SpikeFramesSource ring[SNN_BATCH];
+    spikeTableProducer(&table[sample],&input[0][0],neuronFirstLevel,timestep,0);
+    return spikeFramesRing(&ring[sample],spikeTableRefill,&table[sample],neuronFirstLevel,SPIKE_RING_BLOCK,0) ? NULL : &ring[sample].source;
+}
+
+
+/**
+ * @brief Input of the first layer for the next timestep of all the samples.
+ *
+ * With a single sample, the frame of its source is used in place. Otherwise the frames of the samples
+ * are interleaved in the batch frame, batch[input * SNN_BATCH + sample]; a sample whose spike train
+ * has ended gets no more spikes, and the batch ends with the longest spike train.
+ *
+ * @param sources The source of every sample
+ * @param batch Storage of the batch frame, neuronFirstLevel * SNN_BATCH ints
+ * @return The input of the first layer, NULL when all the spike trains have ended
+ */
+static const int* batchNext(SpikeSource** sources, int* batch)
+{
+#if SNN_BATCH == 1
+    (void)batch;
+    return spikeSourceNext(sources[0]);
+#else
+    static int ended[SNN_BATCH];
+    int active=0;
+    for(int sample=0;sample<SNN_BATCH;sample++){
+        const int* frame=ended[sample] ? NULL : spikeSourceNext(sources[sample]);
+        ended[sample]=frame==NULL;
+        active|=frame!=NULL;
+        for(int j=0;j<neuronFirstLevel;j++){
+            batch[j*SNN_BATCH+sample]=frame!=NULL ? frame[j] : 0;
+        }
+    }
+    return active ? batch : NULL;
+#endif
+}
+
+
+#if TIME_BATCH > 1
+/**
+ * @brief Frames of the next window of timesteps.
+ *
+ * Up to TIME_BATCH frames of the batch are copied in windowFrames, and their spikes in windowSpikes,
+ * a row for every timestep and sample, the left operand of windowProduct.
+ *
+ * @param sources The source of every sample
+ * @param batch Storage of the batch frame, see batchNext
+ * @return The timesteps of the window, fewer than TIME_BATCH when the spike trains end
+ */
+static int windowLoad(SpikeSource** sources, int* batch)
+{
+    int steps;
+    for(steps=0;steps<TIME_BATCH;steps++){
+        const int* frame=batchNext(sources,batch);
+        if(frame==NULL){
+            break;
+        }
+        memcpy(windowFrames[steps],frame,sizeof(windowFrames[steps]));
+        for(int sample=0;sample<SNN_BATCH;sample++){
+            for(int j=0;j<neuronFirstLevel;j++){
+                windowSpikes[steps*SNN_BATCH+sample][j]=frame[j*SNN_BATCH+sample];
+            }
+        }
+    }
+    return steps;
+}
+#endif
+
+
 /**
  * @brief Initializes neurons and starts the simulation.
  *
  * This function configures and opens the cluster, instantiates neurons for the first and second layers,
  * and sends tasks to the cluster cores for neuron and weight instantiation. It then enters the simulation loop,
- * where for each timestep, it initializes neuron outputs, assigns inputs to the first layer, and dispatches the
- * simulation tasks for both layers.
+ * where for each frame of the input source, it initializes neuron outputs, assigns the frame to the first layer,
+ * and dispatches the simulation tasks for both layers.
  *
  * @note This function is intended to be executed on a cluster by core 0.
  */
@@ -463,12 +1006,14 @@ void cluster_simulationSecondLayer(LayerInstanziation* layer)
     secondLayer.output=inputThirdLayer;
     secondLayer.input=inputSecondLayer;
     secondLayer.num_inputs=neuronFirstLevel;
+    secondLayer.current=NULL;
 
     LayerInstanziation firstLayer;
     firstLayer.neuronNumber=neuronFirstLevel;
     firstLayer.neuronLayer=firstLevel;
     firstLayer.output=inputSecondLayer;
     firstLayer.num_inputs=neuronFirstLevel;
+    firstLayer.current=NULL;
 
     /* Init cluster configuration structure. */ 
     pi_cluster_conf_init(&cl_conf); 
@@ -484,33 +1029,84 @@ void cluster_simulationSecondLayer(LayerInstanziation* layer)
     //We can pass only one argument, so the instanziation shoulb be done for every layer?
 
     //The next three function are called in order to instanziate the first layer of neuron, it can be optimized using a struct
-    printf("-------------------FIRST LAYER----------------------\n");
+    traceSummary("-------------------FIRST LAYER----------------------\n");
+    traceSetLayer(0);
     pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, &firstLayer));
     pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate3, &firstLayer));
 
 
-    printf("-------------------SECOND LAYER----------------------\n");
+    traceSummary("-------------------SECOND LAYER----------------------\n");
+    traceSetLayer(1);
     pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, &secondLayer));
     pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate4, &secondLayer));
-    printf("End. Your neuron instanziation:\n"); 
-    printf("\n\n------------------------Start of the simulation-----------------------\n\n");
-    for(int i = 0;i<timestep;i++){
-        printf("\n\n------------------------Timestep %d-----------------------\n\n",i);
+    traceSummary("End. Your neuron instanziation:\n"); 
+    traceSummary("\n\n------------------------Start of the simulation-----------------------\n\n");
+    SpikeSource* sources[SNN_BATCH];
+    static int batch[neuronFirstLevel * SNN_BATCH];
+    for(int sample=0;sample<SNN_BATCH;sample++){
+        sources[sample]=inputSource(sample);
+        if(sources[sample]==NULL){
+            printf("Input source not available !\n");
+            pmsis_exit(-1);
+        }
+    }
+#if SNN_BENCH
+    uint64_t start=benchClock();
+#endif
+    int i;
+    for(i = 0;;i++){
+#if TIME_BATCH > 1
+        //The first layer currents of all the timesteps of a window are computed when it starts
+        int step=i%TIME_BATCH;
+        if(step==0){
+            windowSteps=windowLoad(sources,batch);
+            if(windowSteps>0){
+                pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate7, &firstLayer));
+            }
+        }
+        if(step>=windowSteps){
+            break;
+        }
+        const int* frame=windowFrames[step];
+        firstLayer.current=windowCurrents[step*SNN_BATCH];
+#else
+        //The frame of the timestep is the input of the first layer, it is never copied with a single sample
+        const int* frame=batchNext(sources,batch);
+        if(frame==NULL){
+            break;
+        }
+#endif
+        traceSummary("\n\n------------------------Timestep %d-----------------------\n\n",i);
+        traceSetTimestep(i);
         //initialize output of the neuron layers
         pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &firstLayer));
         pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &secondLayer));
-        for(int j=0;j<neuronFirstLevel;j++){
-            inputFirstLayer[j]=input[j][i];
-            //right assiignment, the input of the first layer is correctly assigned.
+        firstLayer.input=frame;
+#if SNN_BENCH
+        int spikes=0;
+        for(int j=0;j<neuronFirstLevel*SNN_BATCH;j++){
+            spikes+=frame[j];
         }
-        firstLayer.input=inputFirstLayer;
+        benchSpikesAdd(0,0,spikes);
+#endif
         //Assignement between vector pointers
-        printf("\n\n------------------------First layer----------------------\n\n");
+        traceLayer("\n\n------------------------First layer----------------------\n\n");
+        traceSetLayer(0);
         pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate5, &firstLayer));
-        printf("\n\n------------------------Second layer-----------------------\n\n");
+        traceLayer("\n\n------------------------Second layer-----------------------\n\n");
+        traceSetLayer(1);
         pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate6, &secondLayer));
 
     }
+#if SNN_BENCH
+    benchReport("izhikevich",i,benchClock()-start,(uint64_t)i*(neuronFirstLevel+neuronSecondLevel)*SNN_BATCH,
+                benchSpikesOf(0)*neuronFirstLevel+benchSpikesOf(1)*neuronSecondLevel);
+#endif
+    traceDump();
+    perfReport(i);
+    for(int sample=0;sample<SNN_BATCH;sample++){
+        sources[sample]->close(sources[sample]);
+    }
     pi_cluster_close(&cluster_dev); 
     pmsis_exit(0); 
  } 
@@ -526,6 +1122,6 @@ void cluster_simulationSecondLayer(LayerInstanziation* layer)
  */
  int main(void) 
  { 
-    printf("\n\n\t *** Neuron instanziation ***\n\n"); 
+    traceSummary("\n\n\t *** Neuron instanziation ***\n\n"); 
     return pmsis_kickoff((void *) neuronInstanziation); 
  }
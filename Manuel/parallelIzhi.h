@@ -11,14 +11,18 @@
  // Neuron structure declaration
  
  /**
-  * @brief Number of neurons in the first level.
+  * @brief Number of neurons in the first level, which is also the number of primary inputs.
   */
+ #ifndef neuronFirstLevel
  #define neuronFirstLevel 7
+ #endif
  
  /**
   * @brief Number of neurons in the second level.
   */
+ #ifndef neuronSecondLevel
  #define neuronSecondLevel 2
+ #endif
  /*#define num_neuron3rdLevel 12
  #define num_neuron4thLevel 10
  #define num_neuron5thLevel 8
@@ -30,21 +34,137 @@
   * @brief Number of timesteps for the simulation.
   */
  #define timestep 2
+
+ /**
+  * @brief Number of independent samples simulated together, sharing the weights.
+  *
+  * Every neuron has a state for every sample, stored [neuron][batch], and so have the spikes between
+  * the layers, so the weights of a neuron are loaded once and used for all the samples.
+  */
+ #ifndef SNN_BATCH
+ #define SNN_BATCH 1
+ #endif
+
+ /**
+  * @brief Number of timesteps whose first layer currents are computed together.
+  *
+  * With TIME_BATCH > 1 the frames of TIME_BATCH timesteps are read ahead, and the input currents of the
+  * first layer for all of them are a single product of the spike matrix by the weights, so every weight
+  * is loaded once for TIME_BATCH timesteps; the timesteps then only update the membranes of the first layer.
+  */
+ #ifndef TIME_BATCH
+ #define TIME_BATCH 1
+ #endif
  
  
+ /**
+  * @brief If 1, the neuron state is stored in fixed-point (Q16.16 or Q8.8, see fixedPoint.h)
+  * and updated with integer operations only, otherwise it is stored in double.
+  */
+ #ifndef NEURON_FIXED_POINT
+ #define NEURON_FIXED_POINT 0
+ #endif
+
+ #if NEURON_FIXED_POINT
+ #include "fixedPoint.h"
+ typedef fixed_t potential_t;
+ #define POTENTIAL_FROM_DOUBLE(x) FIXED_FROM_DOUBLE(x)
+ #define POTENTIAL_TO_DOUBLE(x) FIXED_TO_DOUBLE(x)
+ #define POTENTIAL_TO_TRACE(x) ((int32_t)(x) * (1 << (16 - FIXED_FRAC_BITS)))
+ #else
+ typedef double potential_t;
+ #define POTENTIAL_FROM_DOUBLE(x) ((double)(x))
+ #define POTENTIAL_TO_DOUBLE(x) ((double)(x))
+ #define POTENTIAL_TO_TRACE(x) ((int32_t)((x) * 65536.0))
+ #endif
+
+ /**
+  * @brief Number of forward Euler sub-steps of a timestep of 1 ms.
+  *
+  * v and u are integrated with IZHI_SUBSTEPS steps of 1/IZHI_SUBSTEPS ms, and a neuron stops at the
+  * sub-step in which it reaches the threshold, so the quadratic term can't blow up inside the timestep.
+  * 1 is the single step of the original model, 2 the half-steps usual for v. In fixed-point the sub-step
+  * is a shift, so IZHI_SUBSTEPS must be a power of two.
+  */
+ #ifndef IZHI_SUBSTEPS
+ #define IZHI_SUBSTEPS 1
+ #endif
+
+ #if IZHI_SUBSTEPS == 1
+ #define IZHI_SUBSTEP_SHIFT 0
+ #elif IZHI_SUBSTEPS == 2
+ #define IZHI_SUBSTEP_SHIFT 1
+ #elif IZHI_SUBSTEPS == 4
+ #define IZHI_SUBSTEP_SHIFT 2
+ #elif IZHI_SUBSTEPS == 8
+ #define IZHI_SUBSTEP_SHIFT 3
+ #elif IZHI_SUBSTEPS == 16
+ #define IZHI_SUBSTEP_SHIFT 4
+ #elif NEURON_FIXED_POINT
+ #error "IZHI_SUBSTEPS must be a power of two up to 16 in fixed-point"
+ #endif
+
+ /**
+  * @brief If 1, the neurons are updated by a vector kernel, with GCC vector extensions.
+  *
+  * A vector of neurons is loaded in registers, integrated with vector operations and stored back; the
+  * spikes are then handled lane by lane. On host the vectors become SSE/AVX instructions, on GAP8 it is
+  * disabled by default, because there is no vector unit for doubles or for the wide fixed-point products.
+  */
+ #ifndef IZHI_VECTOR
+ #if defined(__riscv) || defined(__pulp__)
+ #define IZHI_VECTOR 0
+ #else
+ #define IZHI_VECTOR 1
+ #endif
+ #endif
+
+ /**
+  * @brief Size in bytes of the vectors of potentials of the vector kernel.
+  */
+ #ifndef VECTOR_BYTES
+ #define VECTOR_BYTES 32
+ #endif
+
+ /**
+  * @brief Number of neurons updated together by the vector kernel.
+  */
+ #define izhiLanes ((int)(VECTOR_BYTES / sizeof(potential_t)))
+
+ /**
+  * @brief If 1, a neuron at rest that receives no current is not updated.
+  *
+  * A neuron is at rest when its last update had no current and no spike, and moved v and u by no more
+  * than IZHI_REST_TOLERANCE: it is close to the stable equilibrium of the equations, so its state is
+  * frozen until the next current. The skip is approximate: the drift towards the equilibrium that was
+  * left is dropped, and it accumulates over the skipped timesteps, so v can differ from the full update
+  * by much more than the tolerance (0.08 mV with the default one). It is meant to keep the spikes, not the potentials.
+  */
+ #ifndef IZHI_FAST_PATH
+ #define IZHI_FAST_PATH 0
+ #endif
+
+ /**
+  * @brief Largest change of v and u, in mV, in the update of a neuron at rest.
+  */
+ #ifndef IZHI_REST_TOLERANCE
+ #define IZHI_REST_TOLERANCE 0.001
+ #endif
+
  /**
   * @brief Structure representing an Izhikevich neuron.
   *
   * This structure holds the state and model parameters for a neuron.
   */
  typedef struct {
-     double potential;   // Membrane potential (v)
-     double u;           // Recovery variable (u)
-     double a;           // Parameter 'a' of Izhikevich
-     double b;           // Parameter 'b' of Izhikevich
-     double c;           // Reset potential
-     double d;           // Recovery increment after spike
+     potential_t potential;   // Membrane potential (v)
+     potential_t u;           // Recovery variable (u)
+     potential_t a;           // Parameter 'a' of Izhikevich
+     potential_t b;           // Parameter 'b' of Izhikevich
+     potential_t c;           // Reset potential
+     potential_t d;           // Recovery increment after spike
      int spiked;         // Spike flag
+     int resting;        // 1 when the neuron is at rest, only with IZHI_FAST_PATH
      int num_inputs;     // Number of inputs
  } Neuron;
  
@@ -57,9 +177,10 @@
  typedef struct {
      int neuronNumber;
      int num_inputs;
-     Neuron* neuronLayer;
-     int* output;
-     int* input;
+     Neuron* neuronLayer;    // State of the neurons, neuronLayer[neuron * SNN_BATCH + sample]
+     int* output;            // Spikes of the layer, output[neuron * SNN_BATCH + sample]
+     const int* input;       // Spikes of the inputs, input[input * SNN_BATCH + sample]
+     const int* current;     // Input currents computed ahead, current[sample * neuronNumber + neuron], or NULL
  } LayerInstanziation;
  
  /* Function prototypes*/
@@ -5,31 +5,97 @@
 #include <math.h>
 #include <time.h>
 #include <GapBuiltins.h>
-
-
-//Instanziation of the different layers of our network
-
-Neuron firstLevel[neuronFirstLevel]; 
-Neuron secondLevel[neuronSecondLevel];
-Neuron thirdLevel[neuronThirdLevel];
+#include "snnModel.h"
+
+//Every cluster core traces in its own buffer
+#define traceCore() pi_core_id()
+#include "snnTrace.h"
+#include "snnPerf.h"
+#include "snnBench.h"
+
+
+//Instanziation of the different layers of our network.
+//Every field of the neurons is stored in its own array, and each layer takes a slice of it
+//starting at a multiple of the vector size.
+
+#define neuronPool (alignedLayer(neuronFirstLevel)+alignedLayer(neuronSecondLevel)+alignedLayer(neuronThirdLevel))
+
+potential_t neuronPotential[neuronPool] __attribute__((aligned(VECTOR_BYTES)));
+potential_t neuronThreshold[neuronPool] __attribute__((aligned(VECTOR_BYTES)));
+potential_t neuronReset[neuronPool] __attribute__((aligned(VECTOR_BYTES)));
+DecayFactor neuronDecay[neuronPool];
+int neuronSpiked[neuronPool];
+#if WEIGHT_BITS < 32
+int neuronScale[neuronPool];
+#endif
+
+//Spike lists and synaptic currents of the event-driven propagation, the input list is the one of the primary inputs
+#if EVENT_DRIVEN
+int neuronCurrent[neuronPool] __attribute__((aligned(VECTOR_BYTES)));
+int neuronEvent[neuronPool];
+int neuronEventCount[neuronPool];
+int inputEvent[neuronFirstLevel];
+int inputEventCount[1];
+#endif
+#if LAZY_DECAY
+int neuronLastStep[neuronPool];
+#endif
+
+//Storage of the network described at compile time
+NeuronPool compiledPool={
+    .potential=neuronPotential,.threshold=neuronThreshold,.reset=neuronReset,.decay=neuronDecay,.spiked=neuronSpiked,
+#if WEIGHT_BITS < 32
+    .scale=neuronScale,
+#endif
+#if EVENT_DRIVEN
+    .current=neuronCurrent,.event=neuronEvent,.eventCount=neuronEventCount,
+#endif
+#if LAZY_DECAY
+    .lastStep=neuronLastStep,
+#endif
+};
 
 
 /*Instanziation of the weights of the fully connected network. For every neuron, we have n input
 and m output, where n is the number of neuron of the previous layer, m is the number of neuron of the 
 previous layer*/
+#if WEIGHT_BITS == 32
 int weightsFirstLevel[neuronFirstLevel][neuronFirstLevel];
 int weightsSecondLevel[neuronSecondLevel][neuronFirstLevel];
 int weightsThirdLevel[neuronThirdLevel][neuronSecondLevel];
+#else
+//Quantized weights, every row is padded to weightStrideOf(inputs) weights
+weight_t weightsFirstLevel[neuronFirstLevel][weightStrideOf(neuronFirstLevel)/weightsPerUnit] __attribute__((aligned(4)));
+weight_t weightsSecondLevel[neuronSecondLevel][weightStrideOf(neuronFirstLevel)/weightsPerUnit] __attribute__((aligned(4)));
+weight_t weightsThirdLevel[neuronThirdLevel][weightStrideOf(neuronSecondLevel)/weightsPerUnit] __attribute__((aligned(4)));
+#endif
+
+#if SPARSE_WEIGHTS
+//Pruned weights of the compiled network, sized for the case of no weight pruned.
+//The lines are the rows of the neurons, or the columns of the inputs, with one more start for every layer.
+#define compiledSynapses (neuronFirstLevel*neuronFirstLevel+neuronSecondLevel*neuronFirstLevel+neuronThirdLevel*neuronSecondLevel)
+#define compiledLines (2*neuronFirstLevel+2*neuronSecondLevel+neuronThirdLevel+numberOfLayers)
+int sparseStart[compiledLines];
+int sparseIndex[compiledSynapses];
+int sparseValue[compiledSynapses];
+#endif
 
 
 //Here we define the input/output for every neuron in eache layer.
-int inputFirstLayer[neuronFirstLevel];
-int inputSecondLayer[neuronFirstLevel];
-int inputThirdLayer[neuronSecondLevel];
-int inputFourthLayer[neuronThirdLevel];
+//The input of the first layer is the current frame of the input source.
+spike_t inputSecondLayer[spikeBuffer(neuronFirstLevel)];
+spike_t inputThirdLayer[spikeBuffer(neuronSecondLevel)];
+spike_t inputFourthLayer[spikeBuffer(neuronThirdLevel)];
 
+#if PIPELINE_LAYERS
+//Second output buffer of every layer, the pipelined simulation writes the two buffers in alternate steps
+spike_t pipelineSecondLayer[spikeBuffer(neuronFirstLevel)];
+spike_t pipelineThirdLayer[spikeBuffer(neuronSecondLevel)];
+spike_t pipelineFourthLayer[spikeBuffer(neuronThirdLevel)];
+#endif
 
-//Here we define the train of input of the network
+
+//Here we define the train of input of the network, used when no other source is given
 int input[neuronFirstLevel][timestep] = {
         {1, 0},
         {0, 0},
@@ -44,6 +110,65 @@ int input[neuronFirstLevel][timestep] = {
     };
 
 
+/**
+* @brief Decay factor of a time constant.
+*
+* The decay of the membrane potential in a timestep is exp(-1/tau). Since tau never changes after 
+the instanziation, we compute the factor only once, so the exponential is not evaluated anymore 
+in the simulation. In fixed-point the factor is a multiplier and a shift, decay = multiplier / 2^shift.
+*
+* @param tau Time constant of the leak, in timesteps
+*/
+
+DecayFactor decayFactor(double tau) {
+    DecayFactor decay;
+#if NEURON_FIXED_POINT
+    decay.shift=FIXED_DECAY_SHIFT;
+    decay.multiplier=(int32_t)(exp(-1.0 / tau)*((fixed_wide_t)1<<FIXED_DECAY_SHIFT)+0.5);
+#else
+    decay.factor=exp(-1.0 / tau);
+#endif
+    return decay;
+}
+
+
+
+#if LAZY_DECAY
+/**
+* @brief Decay factor of a number of timesteps.
+*
+* The leak of n silent timesteps is decay^n, computed by repeated squaring, so the cost is log(n).
+For one timestep it is exactly the decay factor. In fixed-point every product is rounded to the shift
+of the factor, so after many timesteps the potential can differ by some units of the last place from 
+the one of n single steps, that stop decaying when reset - potential is a few units.
+*
+* @param decay The decay factor of a timestep
+* @param steps Number of timesteps, at least 1
+*/
+
+DecayFactor decayPower(const DecayFactor* decay, int steps) {
+    DecayFactor power=*decay, square=*decay;
+    for(steps--;steps>0;steps>>=1){
+#if NEURON_FIXED_POINT
+        fixed_wide_t rounding=(fixed_wide_t)1<<(decay->shift-1);
+        if(steps&1){
+            power.multiplier=(int32_t)(((fixed_wide_t)power.multiplier*square.multiplier+rounding)>>decay->shift);
+        }
+        square.multiplier=(int32_t)(((fixed_wide_t)square.multiplier*square.multiplier+rounding)>>decay->shift);
+#else
+        if(steps&1){
+            power.factor*=square.factor;
+        }
+        square.factor*=square.factor;
+#endif
+    }
+    return power;
+}
+#endif
+
+
+
+
 /**
 * @brief Update of the neuron.
 *
@@ -51,165 +176,397 @@ int input[neuronFirstLevel][timestep] = {
 In this case, we will update the spike of the neuron, checking if, after a timestep, 
 the potential has increased over the threshold.
 We will generate some spikes, and we have also the exponential decreasing of the potential during the time.
+It is the scalar version of the membrane update, used when the neurons cannot be updated as a vector.
 *
-* @param n Is the pointer to a neuron array 
+* @param layer The layer of the neuron
 * @param numberNeuron Is the number of the neuron in a specific layer
-* @param inputNextLayer It's the pointer to the vector representing the "output" of a layer.For every layer, the output of each neuron is equal to 1 if we reach the threshold voltage
+* @param decay The precomputed decay factor of the neuron, or of its layer
 */
 
- void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer) {
+ void update_neuron(LayerInstanziation* layer, int numberNeuron, const DecayFactor* decay) {
+    potential_t potential=layer->potential[numberNeuron];
+    potential_t reset=layer->reset[numberNeuron];
     // Apply decay to the membrane potential
-    n->potential=n->reset+(n->potential-n->reset)*exp(-1.0 / n->tau);
-    //n->potential *= exp(-1.0 / n->tau); // Assuming timestep size of 1
+#if NEURON_FIXED_POINT
+    potential=fixed_lif_decay(potential,reset,decay->multiplier,decay->shift);
+#else
+    potential=reset+(potential-reset)*decay->factor;
+#endif
     
     // Check if the neuron spiked
-    if (n->potential >= n->threshold) {
-        n->spiked = 1;
-        inputNextLayer[numberNeuron] = 1;        
-        n->potential = n->reset;  // Reset potential after spike
-    } else {
-        n->spiked = 0;        
-    }
+    int spiked=potential>=layer->threshold[numberNeuron];
+    layer->potential[numberNeuron]=spiked ? reset : potential;  // Reset potential after spike
+    layer->spiked[numberNeuron]=spiked;
+}
+
+
+
+#if MEMBRANE_SIMD == 1
+/**
+* @brief Vector update of the neurons with a shared decay factor.
+*
+* The decay, the threshold comparison and the reset of a whole vector of neurons are computed
+with GCC vector extensions, so on host they become SSE/AVX instructions.
+The reset after a spike is a bitwise select with the mask of the comparison, so there are no branches.
+*
+* @param layer The layer to update
+* @param i The first neuron of the vector
+*/
 
-    printf("Neuron -> %d, potential: %.2f, threshold: %.2f, spiked: %d\n",
-                numberNeuron, n->potential, n->threshold, n->spiked);
+static inline void update_neuron_vector(LayerInstanziation* layer, int i) {
+    potentialVector potential=*(potentialVector*)&layer->potential[i];
+    potentialVector reset=*(potentialVector*)&layer->reset[i];
+    potentialVector threshold=*(potentialVector*)&layer->threshold[i];
+#if NEURON_FIXED_POINT
+    typedef fixed_wide_t wideVector __attribute__((vector_size(neuronVectorLanes*sizeof(fixed_wide_t))));
+    //As in fixed_lif_decay, the difference and the result are computed on the wide type and saturated
+    wideVector wideReset=__builtin_convertvector(reset,wideVector);
+    wideVector delta=__builtin_convertvector(potential,wideVector)-wideReset;
+    delta=wideReset+((delta*layer->decay.multiplier+((fixed_wide_t)1<<(layer->decay.shift-1)))>>layer->decay.shift);
+    wideVector high=delta>FIXED_MAX, low=delta<FIXED_MIN;
+    delta=(delta&~(high|low))|(FIXED_MAX&high)|(FIXED_MIN&low);
+    potential=__builtin_convertvector(delta,potentialVector);
+#else
+    potential=reset+(potential-reset)*layer->decay.factor;
+#endif
+    potentialMaskVector spike=potential>=threshold;
+    potential=(potentialVector)(((potentialMaskVector)potential&~spike)|((potentialMaskVector)reset&spike));
+    *(potentialVector*)&layer->potential[i]=potential;
+    for(int k=0;k<neuronVectorLanes;k++){
+        layer->spiked[i+k]=-spike[k];
+    }
 }
+#elif MEMBRANE_SIMD == 2
+/**
+* @brief Packed SIMD update of two Q8.8 neurons with a shared decay factor.
+*
+* The comparison and the select work on both halves of a v2s register.
+The decay of every half is fixed_lif_decay: the difference v - reset doesn't fit the Q8.8 range when
+negative weights push the potential far below the reset, so it is taken on 32 bits, where the product
+with the multiplier can't overflow, instead of the 16x16 p.mulsRN.
+*
+* @param layer The layer to update
+* @param i The first neuron of the pair
+*/
 
+static inline void update_neuron_vector(LayerInstanziation* layer, int i) {
+    potentialVector potential=*(potentialVector*)&layer->potential[i];
+    potentialVector reset=*(potentialVector*)&layer->reset[i];
+    potentialVector threshold=*(potentialVector*)&layer->threshold[i];
+    int multiplier=layer->decay.multiplier, shift=layer->decay.shift;
+    potential=(potentialVector)gap_pack2(fixed_lif_decay(potential[0],reset[0],multiplier,shift),
+                                         fixed_lif_decay(potential[1],reset[1],multiplier,shift));
+    potentialMaskVector spike=potential>=threshold;
+    potential=(potentialVector)(((potentialMaskVector)potential&~spike)|((potentialMaskVector)reset&spike));
+    *(potentialVector*)&layer->potential[i]=potential;
+    layer->spiked[i]=-spike[0];
+    layer->spiked[i+1]=-spike[1];
+}
+#endif
 
 
 
 /**
-* @brief Simulation of the first layer.
+* @brief Membrane update of a block of neurons.
 *
-* Here we are simulating the first layer.
-We'd like to simulate every layer with the same function, 
-but we have some problem with the passing argument of the weights, and so we do it manually.
-We'd like to insert it in the LayerInstanziation struct, but for now, we're not able to do it.
-However, what we do is to increase the potential of each neuron if a specif input of the neuron is equal to 1.
-j represent the number of input that each neuron will receive from the previous layer.
-For example, weightsFirstLevel[2][3] is the weight of the connection that connect 
-the second neuron of this layer with the third neuron of the previous layer.
-The same is done for all other layers.
+* All the neurons in [begin,end) are updated. When the decay factor is shared by the layer, 
+we process whole vectors of neurons, and only the remaining neurons go through the scalar update_neuron.
+Then the spike flags of the block are copied, or packed, in the output of the layer.
+The neurons are traced only at the TRACE_NEURON level, otherwise the loop is not compiled.
 *
-* @param layer It is the layer that we are simulating
-* @param core_id The core (0-7) on which is executed the function
-* @param iteration It is the number of time that the function has been executed on the parallel cores
-* @param num_inputs is the number of inputs that each neuron receives(it can be 0 or 1)
-*/
-
-
-void simulateFirstLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            for (int j = 0; j < num_inputs; j++) {
-                //printf("%d\n",layer->input[j]);
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    //layer->neuronLayer[core_id+iteration*8].potential = gap_add2((layer->neuronLayer[core_id+iteration*8].potential),(weightsFirstLevel[core_id+iteration*8][j]));
-                    layer->neuronLayer[neuronNumber].potential += weightsFirstLevel[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
-            }
-            update_neuron(&(layer->neuronLayer[neuronNumber]), neuronNumber, layer->output);
+* @param layer The layer to update
+* @param begin First neuron of the block
+* @param end Neuron after the last of the block
+*/
+
+void membraneUpdate(LayerInstanziation* layer, int begin, int end) {
+    int i=begin;
+#if MEMBRANE_SIMD
+    if(layer->sharedDecay){
+        for(;i+neuronVectorLanes<=end;i+=neuronVectorLanes){
+            update_neuron_vector(layer,i);
+        }
+    }
+#endif
+    for(;i<end;i++){
+        update_neuron(layer,i,layer->sharedDecay ? &layer->decay : &layer->neuronDecay[i]);
+    }
+    //The spikes of the block become the output of the layer
+#if SPIKE_PACKED
+    spikePack(layer->output,layer->spiked,begin,end);
+#else
+    for(i=begin;i<end;i++){
+        layer->output[i]=layer->spiked[i];
+    }
+#endif
+#if SNN_TRACE_LEVEL >= TRACE_NEURON
+    for(i=begin;i<end;i++){
+        traceNeuron(layer->step,layer->index,i,POTENTIAL_TO_TRACE(layer->potential[i]),layer->spiked[i],
+                "Neuron -> %d, potential: %.2f, threshold: %.2f, spiked: %d\n",
+                i, POTENTIAL_TO_DOUBLE(layer->potential[i]), POTENTIAL_TO_DOUBLE(layer->threshold[i]), layer->spiked[i]);
     }
+#endif
 }
 
 
 
+
+#if WEIGHT_BITS < 32
 /**
-* @brief Simulation of the second layer.
+* @brief Scale of the quantized weights of a neuron.
 *
-* Here we are simulating the second layer.
-We'd like to simulate every layer with the same function, 
-but we have some problem with the passing argument of the weights, and so we do it manually.
-We'd like to insert it in the LayerInstanziation struct, but for now, we're not able to do it.
-However, what we do is to increase the potential of each neuron if a specif input of the neuron is equal to 1.
-j represent the number of input that each neuron will receive from the previous layer.
-For example, weightsSecondLevel[2][3] is the weight of the connection that connect 
-the second neuron of this layer with the third neuron of the previous layer.
-The same is done for all other layers.
+* The smallest integer scale for which the largest weight of the neuron fits the range of q,
+so the weights of a neuron that already fit are stored exactly, with scale 1.
 *
-* @param layer It is the layer that we are simulating
-* @param core_id The core (0-7) on which is executed the function
-* @param iteration It is the number of time that the function has been executed on the parallel cores
-* @param num_inputs is the number of inputs that each neuron receives(it can be 0 or 1)
+* @param largest Largest absolute value of the weights of the neuron
 */
 
+static inline int weightScaleOf(int largest)
+{
+    return largest>weightMax ? (largest+weightMax-1)/weightMax : 1;
+}
 
-void simulateSecondLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            for (int j = 0; j < num_inputs; j++) {
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    layer->neuronLayer[neuronNumber].potential += weightsSecondLevel[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
-            }
-            update_neuron(&(layer->neuronLayer[neuronNumber]), neuronNumber, layer->output);
+
+
+/**
+* @brief Quantized value of a weight, rounded to the nearest multiple of the scale.
+*/
+
+static inline int weightQuantize(int weight, int scale)
+{
+    int q=(weight>=0 ? weight+scale/2 : weight-scale/2)/scale;
+    return q>weightMax ? weightMax : (q<-weightMax ? -weightMax : q);
+}
+
+
+
+/**
+* @brief Quantization of the weights of a neuron.
+*
+* The count weights of the neuron become its row of stride quantized weights, whose padding is cleared.
+*
+* @param source The weights of the neuron
+* @param count Number of weights
+* @param stride Number of weights of the row, with the padding
+* @param row The row of quantized weights
+* @return The scale of the neuron
+*/
+
+static int quantizeRow(const int32_t* source, int count, int stride, weight_t* row)
+{
+    int largest=0;
+    for(int j=0;j<count;j++){
+        int magnitude=source[j]>=0 ? source[j] : -source[j];
+        largest=magnitude>largest ? magnitude : largest;
+    }
+    int scale=weightScaleOf(largest);
+    for(int j=0;j<stride;j++){
+        weightSet(row,j,j<count ? weightQuantize(source[j],scale) : 0);
     }
+    return scale;
 }
+#endif
 
 
 
+/**
+* @brief Synaptic current of a run of inputs.
+*
+* The sum of the stored weights of the spiking inputs [first,first+count) of a neuron, whose weights
+are the ones from the weight offset of weights. With bit-packed spikes only the set bits of the words
+are visited. With WEIGHT_SDOTP, four spikes of the int8 weights are packed in a v4s and multiplied
+by four weights with a single sdotp4.
+*
+* @param input Spikes of the inputs of the layer
+* @param first First input of the run
+* @param count Number of inputs of the run
+* @param weights Weights of the run
+* @param offset Position in weights of the weight of the input first
+*/
+
+static inline int accumulateSegment(const spike_t* input, int first, int count, const weight_t* weights, int offset)
+{
+    int input_current=0;
+#if SPIKE_PACKED
+    for(int j=first;j<first+count;){
+        int w=j/spikeWordBits;
+        int last=(w+1)*spikeWordBits<first+count ? (w+1)*spikeWordBits : first+count;
+        spike_word_t word=input[w]>>(j%spikeWordBits);
+        if(last-j<spikeWordBits){
+            word&=((spike_word_t)1<<(last-j))-1;
+        }
+        for(;word;word&=word-1){
+            input_current+=weightGet(weights,offset+j-first+spikeFirst(word));
+        }
+        j=last;
+    }
+#else
+    int j=0;
+#if WEIGHT_BITS == 8 && WEIGHT_SDOTP
+    for(;j<count && (offset+j)%4;j++){
+        input_current+=input[first+j]*weightGet(weights,offset+j);
+    }
+    for(;j+4<=count;j+=4){
+        const spike_t* spikes=input+first+j;
+        v4s packed={(signed char)spikes[0],(signed char)spikes[1],(signed char)spikes[2],(signed char)spikes[3]};
+        input_current=gap_sumdotp4(packed,*(const v4s*)(weights+offset+j),input_current);
+    }
+#endif
+    //The spikes are 0 or 1, so the product is a select without branches
+    for(;j<count;j++){
+        input_current+=input[first+j]*weightGet(weights,offset+j);
+    }
+#endif
+    return input_current;
+}
+
+
+
+#if WEIGHT_TILING
+//Double buffers in L1 of the weight tiles, two tiles for every core
+static weight_t* weightTiles;
+
+
 
 /**
-* @brief Simulation of the third layer.
+* @brief Synaptic accumulation of a block of neurons with the weights streamed from L2.
 *
-* Here we are simulating the third layer.
-We'd like to simulate every layer with the same function, 
-but we have some problem with the passing argument of the weights, and so we do it manually.
-We'd like to insert it in the LayerInstanziation struct, but for now, we're not able to do it.
-However, what we do is to increase the potential of each neuron if a specif input of the neuron is equal to 1.
-j represent the number of input that each neuron will receive from the previous layer.
-For example, weightsThirdLevel[2][3] is the weight of the connection that connect 
-the second neuron of this layer with the third neuron of the previous layer.
-The same is done for all other layers.
+* The weights of the neurons [begin,end) are a contiguous run of rows, that the core copies in L1 
+with the cluster DMA one tile at a time, in its two buffers: while the tile k is accumulated,
+the tile k+1 is transferred. A tile can end in the middle of a row, so the current of a neuron
+is kept across the tiles and added to its potential at the end of its row.
+A tile is a whole number of weight_t, so with 4 bit weights it always starts on an even weight.
 *
-* @param layer It is the layer that we are simulating
-* @param core_id The core (0-7) on which is executed the function
-* @param iteration It is the number of time that the function has been executed on the parallel cores
-* @param num_inputs is the number of inputs that each neuron receives(it can be 0 or 1)
-*/
-
-void simulateThirdLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            for (int j = 0; j < num_inputs; j++) {
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    layer->neuronLayer[neuronNumber].potential += weightsThirdLevel[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
+* @param layer The layer to simulate
+* @param begin First neuron of the block
+* @param end Neuron after the last of the block
+*/
+
+static void accumulateTiled(LayerInstanziation* layer, int begin, int end)
+{
+    weight_t* buffer[2];
+    buffer[0]=weightTiles+pi_core_id()*2*weightTileUnits;
+    buffer[1]=buffer[0]+weightTileUnits;
+    const weight_t* weights=weightAt(layer->weights,begin*layer->weightStride);
+    //Number of weights of the block and of a tile, the padding of the rows included
+    int total=(end-begin)*layer->weightStride;
+    int tileWeights=weightTileWeights;
+    if(total==0){
+        return;
+    }
+    pi_cl_dma_copy_t copy;
+    copy.dir=PI_CL_DMA_DIR_EXT2LOC;
+    copy.merge=0;
+    copy.ext=(uintptr_t)weights;
+    copy.loc=(uintptr_t)buffer[0];
+    copy.size=(total<tileWeights ? total : tileWeights)/weightsPerUnit*sizeof(weight_t);
+    pi_cl_dma_memcpy(&copy);
+    int neuronNumber=begin,input=0,input_current=0;
+    for(int tile=0,first=0;first<total;tile++,first+=tileWeights){
+        int count=total-first<tileWeights ? total-first : tileWeights;
+        pi_cl_dma_wait(&copy);
+        if(first+count<total){
+            int next=total-first-count;
+            copy.ext=(uintptr_t)weightAt(weights,first+count);
+            copy.loc=(uintptr_t)buffer[(tile+1)&1];
+            copy.size=(next<tileWeights ? next : tileWeights)/weightsPerUnit*sizeof(weight_t);
+            pi_cl_dma_memcpy(&copy);
+        }
+        const weight_t* tileBuffer=buffer[tile&1];
+        for(int k=0;k<count;){
+            //The rest of the row of the neuron, or of the tile, without the padding of the row
+            int segment=layer->weightStride-input<count-k ? layer->weightStride-input : count-k;
+            int live=layer->num_inputs-input<segment ? layer->num_inputs-input : segment;
+            if(live>0){
+                input_current+=accumulateSegment(layer->input,input,live,tileBuffer,k);
+            }
+            k+=segment;
+            input+=segment;
+            if(input==layer->weightStride){
+                layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],
+                        weightScaled(layer,neuronNumber,input_current));
+                neuronNumber++;
+                input=0;
+                input_current=0;
             }
-            update_neuron(&(layer->neuronLayer[neuronNumber]), neuronNumber, layer->output);
+        }
     }
 }
+#endif
 
 
-/*
-void simulateLayer(LayerInstanziation* layer,int core_id,int iteration,int num_inputs) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
-            for (int j = 0; j < num_inputs; j++) {
-                if (layer->input[j] == 1) {
-                    //printf("ECCOMI");
-                    layer->neuronLayer[neuronNumber].potential += layer->weights[neuronNumber][j];
-                }
-                //To see better the evolution of neuron, put update_neuron here.
-                //update_neuron(&neurons[i], i, inputNextLayer);
+
+/**
+* @brief Simulation of a block of neurons of a layer.
+*
+* Here we are simulating the neurons [begin,end) of a generic layer.
+The weights of the layer are stored inside the LayerInstanziation struct, as a pointer to a row-major matrix
+and the stride between two rows, so the same function is used for every layer of the network.
+What we do is to increase the potential of each neuron if a specif input of the neuron is equal to 1.
+j represent the number of input that each neuron will receive from the previous layer.
+For example, layer->weights[2*layer->weightStride+3] is the weight of the connection that connect 
+the second neuron of this layer with the third neuron of the previous layer.
+With bit-packed spikes, only the set bits of the input are visited, so the cost is proportional
+to the number of active inputs and not to the number of inputs.
+In the event-driven propagation, the weights are column-major and we add, to all the neurons of the block,
+the column of every input that spiked, taken from the spike list of the previous layer.
+With SPARSE_WEIGHTS only the weights left by the pruning are visited, from the CSR row of every neuron,
+or in the event-driven propagation from the CSC column of every input that spiked.
+With WEIGHT_TILING, the rows are streamed from L2 in L1 tiles by accumulateTiled.
+With quantized weights, the sum of the stored weights of a neuron is multiplied by its scale.
+Then the membrane of the whole block is updated by membraneUpdate.
+*
+* @param layer It is the layer that we are simulating
+* @param begin First neuron of the block
+* @param end Neuron after the last of the block
+*/
+
+void simulateLayer(LayerInstanziation* layer,int begin,int end) {
+#if EVENT_DRIVEN
+    //Only the columns of the sources that spiked are added to the currents of the block
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+        layer->current[neuronNumber]=0;
+    }
+#if SPARSE_WEIGHTS
+    sparseScatter(layer->inputEvents,&layer->sparse,layer->current,begin,end);
+#else
+    spikeListScatter(layer->inputEvents,layer->weights,layer->weightStride,layer->current,begin,end);
+#endif
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+        layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],layer->current[neuronNumber]);
+    }
+#elif WEIGHT_TILING
+    accumulateTiled(layer,begin,end);
+#elif SPARSE_WEIGHTS
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+#if SPIKE_PACKED
+        int input_current=sparseRowPacked(&layer->sparse,neuronNumber,layer->input);
+#else
+        int input_current=sparseRowFlags(&layer->sparse,neuronNumber,layer->input);
+#endif
+        layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],input_current);
+    }
+#else
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+        const weight_t* weights=weightAt(layer->weights,neuronNumber*layer->weightStride);
+        //The synaptic current is accumulated on an integer, because the weights are integers
+#if WEIGHT_BITS < 32
+        int input_current=weightScaled(layer,neuronNumber,accumulateSegment(layer->input,0,layer->num_inputs,weights,0));
+#elif SPIKE_PACKED
+        int input_current=spikeAccumulate(layer->input,spikeWords(layer->num_inputs),weights);
+#else
+        int input_current=0;
+        for (int j = 0; j < layer->num_inputs; j++) {
+            if (layer->input[j] == 1) {
+                input_current+=weights[j];
             }
-            update_neuron(&(layer->neuronLayer[neuronNumber]), neuronNumber, layer->output);
+        }
+#endif
+        layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],input_current);
     }
+#endif
+    membraneUpdate(layer,begin,end);
 }
-*/
 
 
 
@@ -220,31 +577,30 @@ void simulateLayer(LayerInstanziation* layer,int core_id,int iteration,int num_i
 * This is the inizialization of every neuron.
 We perform the inizialization with standard value of the LIF literature, 
 and we do it for every neuron and for every layer of the network.
-We use some GAP SDK function in order to optimize the computation of the neuron's index to be updated. 
-We perform 8 inizialization at a time, one on every core.
+Every core initializes the neurons of its range.
 *
-* @param core_id The core (0-7) on which is executed the function
+* @param layer It is the layer that we are instanziating
+* @param begin First neuron of the range
+* @param end Neuron after the last of the range
 * @param threshold Thresold voltage of each neuron for the LIF model
 * @param resetValue Reset voltage of each neuron for the LIF model
-* @param num_inputs Number of inputs of each neuron
 * @param tau A discharge component for the LIF model
-* @param iteration It is the number of time that the function has been executed on the parallel cores
-* @param layer It is the layer that we are instanziating
 */
 
-void initializeNeuron(int core_id, double threshold, double resetValue, int num_inputs, double tau,int iteration,LayerInstanziation* layer) {
-        int iterationNumber=gap_muls(iteration,8);
-        int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-        if(neuronNumber< layer->neuronNumber){
-            //We use GAP efficient mul function
-            layer->neuronLayer[neuronNumber].potential = -65.0;
-            layer->neuronLayer[neuronNumber].threshold = threshold;
-            layer->neuronLayer[neuronNumber].spiked = false;
-            layer->neuronLayer[neuronNumber].reset = resetValue;
-            layer->neuronLayer[neuronNumber].num_inputs = num_inputs;
-            layer->neuronLayer[neuronNumber].tau = tau; // Set the time constant
-            printf("Neuron number %d instanziate by core %d\n",neuronNumber,core_id);
-            printf("Potential : %f\nThresold : %f\n",layer->neuronLayer[neuronNumber].potential,layer->neuronLayer[neuronNumber].threshold);
+void initializeNeuron(LayerInstanziation* layer, int begin, int end, double threshold, double resetValue, double tau) {
+        DecayFactor decay=decayFactor(tau); // Decay factor of the time constant
+        for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+            layer->potential[neuronNumber] = POTENTIAL_FROM_DOUBLE(resetValue);
+            layer->threshold[neuronNumber] = POTENTIAL_FROM_DOUBLE(threshold);
+            layer->spiked[neuronNumber] = false;
+            layer->reset[neuronNumber] = POTENTIAL_FROM_DOUBLE(resetValue);
+            layer->neuronDecay[neuronNumber] = decay;
+#if LAZY_DECAY
+            layer->lastStep[neuronNumber] = -1;
+#endif
+            traceNeuron(-1,layer->index,neuronNumber,POTENTIAL_TO_TRACE(layer->potential[neuronNumber]),0,
+                    "Neuron number %d instanziate by core %d\nPotential : %f\nThresold : %f\n",neuronNumber,(int)pi_core_id(),
+                    POTENTIAL_TO_DOUBLE(layer->potential[neuronNumber]),POTENTIAL_TO_DOUBLE(layer->threshold[neuronNumber]));
         }
 }
 
@@ -255,20 +611,17 @@ void initializeNeuron(int core_id, double threshold, double resetValue, int num_
 *
 * In this function we're initializing all outputs of a layer of the network,
  that will be ever equal to 0 initially.
-We use some GAP_SDK function to compute the index of the neuron
+Every core clears the outputs of its range; with bit-packed spikes, the range is of words of 32 outputs.
 *
 * @param layer The layer to which initialize all outputs.
-* @param core_id The core (0-7) on which is executed the function
-* @param iteration It is the number of time that the function has been executed on the parallel cores
+* @param begin First output of the range
+* @param end Output after the last of the range
 */
 
 
-void init_output( LayerInstanziation* layer,int core_id,int iteration) {
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
+void init_output( LayerInstanziation* layer,int begin,int end) {
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
         layer->output[neuronNumber]=0;
-        //printf("Output fissato a %d da core %d\n",layer->output[core_id],core_id);
     }
 }
 
@@ -284,54 +637,67 @@ we will have N inputs and M outputs connection.
 N is the number of neuron of the previous layer, M is the number of neuron of the next layer.
 In this case, the matrix weights has dimension p x N, where p is the number of neuron of the layer
 *
+The weight of a neuron is its index modulo 8, the core that initialized it when the neurons were
+distributed round-robin on the eight cores, so the network doesn't depend on the number of cores.
+With quantized weights the row of the neuron is quantized with its scale.
+*
 * @param layer The layer to which initialize all weights with the previous layer of the network.
-* @param core_id The core (0-7) on which is executed the function
-* @param iteration It is the number of time that the function has been executed on the parallel cores
+* @param begin First neuron of the range
+* @param end Neuron after the last of the range
 * @param input It's the number of input connections of each neuron, equal to the number of neuron of the previous layer(fully connected network)
-* @param weights Matrix of the weights representing that layer.
 */
 
-void initialize_weights(LayerInstanziation* layer, int core_id, int iteration,int input,int weights[][input]){
-    int iterationNumber=gap_muls(iteration,8);
-    int neuronNumber=gap_addnormu(core_id,iterationNumber,0);
-    if(neuronNumber<layer->neuronNumber){
+void initialize_weights(LayerInstanziation* layer, int begin, int end,int input){
+    for(int neuronNumber=begin;neuronNumber<end;neuronNumber++){
+#if WEIGHT_BITS < 32
+        //All the weights of the neuron are the same, so the largest one is any of them
+        int scale=weightScaleOf(neuronNumber%8);
+        weight_t* row=weightAt(layer->weights,neuronNumber*layer->weightStride);
+        layer->weightScale[neuronNumber]=scale;
+        for(int i=0;i<layer->weightStride;i++){
+            weightSet(row,i,i<input ? weightQuantize(neuronNumber%8,scale) : 0);
+        }
+#else
         for(int i=0;i<input;i++){
-            int randomInRange = core_id;
+            int randomInRange = neuronNumber%8;
             /*int random_value = pi_rand();  // PULP function to generate a number on 32 bits.
 
             //Random value between -5 and 5
             int randomInRange = (random_value % 11) - 5;
             */
-            weights[neuronNumber][i]=randomInRange;
+            layer->weights[weightIndex(layer,neuronNumber,i)]=randomInRange;
             //printf("Weights posizione %d %d fissato a %d\n",core_id,i,randomInRange);
         }
+#endif
     }
 }
 
 
 
 /**
-* @brief Weights instanziation of the third layer.
+* @brief Neuron instanziation of a layer.
 *
 * This function takes one layer and will run the instanziation of every neuron of the layer.
-This function will be executed on the eight parallel cores, and will stop only when all the neuron 
-are instanziated correctly. 
-We call for every neuron the initializeNeuron function.
+This function will be executed on the parallel cores, and every core instanziates a contiguous chunk 
+of the layer (see partition.h), calling the initializeNeuron function on it.
+All the neurons of the layer have the same parameters, taken from the layer itself, 
+so core 0 also stores the decay factor in the layer.
 *
-* @param layer The layer to simulate, in this case the third one.
+* @param layer The layer to instanziate.
 */
   
 void cluster_neuronInstanziation(LayerInstanziation* layer) 
 { 
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();
-    uint32_t iteration = 0;
-    int iterationNumber=gap_muls(iteration,8);
-    while(layer->neuronNumber>iterationNumber){
-        //standard value for LIF  
-        initializeNeuron(core_id,-50.0, -65.0, layer->num_inputs, 10.0,iteration,layer);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+    uint32_t core_id = pi_core_id();
+    NeuronParameters* parameters=&layer->parameters;
+    Range range=partitionCore(layer->neuronNumber,neuronBlock);
+    PerfSample sample;
+    perfBegin(&sample);
+    if(core_id==0){
+        layer->decay=decayFactor(parameters->tau);
     }
+    initializeNeuron(layer,range.begin,range.end,parameters->threshold,parameters->reset,parameters->tau);
+    perfEnd(PERF_INIT,&sample);
 } 
 
 
@@ -342,185 +708,677 @@ void cluster_neuronInstanziation(LayerInstanziation* layer)
 *
 * This function takes one layer and will run the instanziation of the output for every neuron of the layer.
 We're going to instanziate all outputs of each neuron to 0.
-This function will be executed on the eight parallel cores, and will stop only when all the neuron and their output
-are instanziated correctly. 
-We call for every neuron the init_output function.
+This function will be executed on the parallel cores, and every core calls the init_output function 
+on a contiguous chunk of the outputs.
+It runs before every timestep, so in the dynamic partition core 0 also gives back all the blocks of the layer.
 *
 * @param layer The layer to simulate, in this case the third one.
 */
 
 void cluster_outputInstanziation(LayerInstanziation* layer) 
 { 
-    uint32_t iteration =0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    uint32_t iterationNumber=gap_muls(iteration,8);
-    while(layer->neuronNumber>iterationNumber){ 
-        init_output(layer,core_id,iteration);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+    Range range=partitionCore(spikeBuffer(layer->neuronNumber),1);
+    PerfSample sample;
+    perfBegin(&sample);
+#if DYNAMIC_PARTITION
+    if(pi_core_id()==0){
+        layer->nextBlock=0;
     }
+#endif
+    init_output(layer,range.begin,range.end);
+    perfEnd(PERF_OUTPUT,&sample);
 } 
 
 
 
 /**
-* @brief Weights instanziation of the first layer.
+* @brief Weights instanziation of a layer.
 *
-* This function takes the first layer and will run the instanziation of the weights for every neuron of the layer.
+* This function takes one layer and will run the instanziation of the weights for every neuron of the layer.
 We're simulating a fully connected network, so for every neuron, we need to define the weights of the connection
 with every neuron of the previous layer. In the case of the first layer, we need to define the weights that
 connect every neuron with the primary inputs.
-This function will be executed on the eight parallel cores, and will stop only when all the neuron and their weights
-are instanziated correctly.
-We call for every neuron the initialize_weights function.
+The weights matrix is the one pointed by the layer itself, so the same function is used for every layer.
+This function will be executed on the parallel cores, and every core calls the initialize_weights function 
+on a contiguous chunk of the neurons.
 *
-* @param layer The layer to simulate, in this case the first one.
+* @param layer The layer to which initialize the weights.
 */
 
-void cluster_weightsInstanziationFirstLayer(LayerInstanziation* layer) 
+void cluster_weightsInstanziation(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    int iterationNumber=gap_muls(iteration,8); 
-    while(layer->neuronNumber>iterationNumber){
-        initialize_weights(layer,core_id,iteration,layer->num_inputs,weightsFirstLevel);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
-    }
+    Range range=partitionCore(layer->neuronNumber,neuronBlock);
+    PerfSample sample;
+    perfBegin(&sample);
+    initialize_weights(layer,range.begin,range.end,layer->num_inputs);
+    perfEnd(PERF_INIT,&sample);
 } 
 
 
 
 /**
-* @brief Weights instanziation of the second layer.
+* @brief Input of the first layer.
 *
-* This function takes the second layer and will run the instanziation of the weights for every neuron of the layer.
-We're simulating a fully connected network, so for every neuron, we need to define the weights of the connection
-with every neuron of the previous layer
-This function will be executed on the eight parallel cores, and will stop only when all the neuron and their weights
-are instanziated correctly. 
-We call for every neuron the initialize_weights function.
+* The next frame of the input source becomes the input of the first layer: only the pointer
+of the layer changes, the spikes are never copied.
+In the event-driven propagation, the spike list of the inputs is also built from the frame.
+When the source has no more frames, the network stops running, otherwise the next timestep starts.
+This function is executed by a single core.
 *
-* @param layer The layer to simulate, in this case the second one.
+* @param network The network
 */
 
+void loadInput(NetworkInstanziation* network)
+{
+    const spike_t* frame=spikeSourceNext(network->source);
+    network->running=frame!=NULL;
+    if(frame==NULL){
+        return;
+    }
+    LayerInstanziation* first=&network->layers[0];
+    first->input=frame;
+    network->step++;
+    traceSetTimestep(network->step);
+    for(int l=0;l<network->layerNumber;l++){
+        network->layers[l].step=network->step;
+    }
+#if EVENT_DRIVEN
+    //The spike list of the primary inputs is a single block
+    int spikes=0;
+    int* events=first->inputEvents->index;
+#if SPIKE_PACKED
+    for(int w=0;w<spikeWords(first->num_inputs);w++){
+        for(spike_word_t word=frame[w];word;word&=word-1){
+            events[spikes++]=w*spikeWordBits+spikeFirst(word);
+        }
+    }
+#else
+    for(int j=0;j<first->num_inputs;j++){
+        if(frame[j]==1){
+            events[spikes++]=j;
+        }
+    }
+#endif
+    first->inputEvents->count[0]=spikes;
+    benchSpikesAdd(0,0,spikes);
+#elif SNN_BENCH
+    int spikes=0;
+#if SPIKE_PACKED
+    for(int w=0;w<spikeWords(first->num_inputs);w++){
+        spikes+=spikeCount(frame[w]);
+    }
+#else
+    for(int j=0;j<first->num_inputs;j++){
+        spikes+=frame[j];
+    }
+#endif
+    benchSpikesAdd(0,0,spikes);
+#endif
+}
 
-void cluster_weightsInstanziationSecondLayer(LayerInstanziation* layer) 
-{ 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    int iterationNumber=gap_muls(iteration,8); 
-    while(layer->neuronNumber>iterationNumber){
-        initialize_weights(layer,core_id,iteration,layer->num_inputs,weightsSecondLevel);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+
+
+/**
+* @brief Output of a block of neurons of a layer, after the membrane update.
+*
+* In the event-driven propagation, the spikes of the block are compacted in the spike list of the layer.
+*
+* @param layer The layer
+* @param block Number of the block in the spike list of the layer
+* @param range Neurons of the block
+*/
+
+static inline void publishBlock(LayerInstanziation* layer, int block, Range range)
+{
+#if EVENT_DRIVEN
+    spikeListBlock(layer->outputEvents,block,layer->spiked,range.begin,range.end);
+#else
+    (void)block;
+#endif
+#if SNN_BENCH
+    int spikes=0;
+    for(int n=range.begin;n<range.end;n++){
+        spikes+=layer->spiked[n];
     }
-} 
+    benchSpikesAdd(pi_core_id(),layer->index+1,spikes);
+#elif !EVENT_DRIVEN
+    (void)layer;
+    (void)range;
+#endif
+}
+
 
 
+#if LAZY_DECAY
 /**
-* @brief Weights instanziation of the third layer.
+* @brief Leak of the silent timesteps of a neuron.
 *
-* This function takes the third layer and will run the instanziation of the weights for every neuron of the layer.
-We're simulating a fully connected network, so for every neuron, we need to define the weights of the connection
-with every neuron of the previous layer
-This function will be executed on the eight parallel cores, and will stop only when all the neuron and their weights
-are instanziated correctly. 
-We call for every neuron the initialize_weights function.
+* The neuron received no current after its last update, so in every timestep until step it only
+decayed towards the reset, and the potential is moved there at once with decay^dt.
 *
-* @param layer The layer to simulate, in this case the third one.
+* @param layer The layer of the neuron
+* @param neuronNumber The neuron
+* @param step Timestep whose final state is wanted
 */
 
-void cluster_weightsInstanziationThirdLayer(LayerInstanziation* layer) 
-{ 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    int iterationNumber=gap_muls(iteration,8); 
-    while(layer->neuronNumber>iterationNumber){
-        initialize_weights(layer,core_id,iteration,layer->num_inputs,weightsThirdLevel);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+static inline void lazyAdvance(LayerInstanziation* layer, int neuronNumber, int step)
+{
+    int elapsed=step-layer->lastStep[neuronNumber];
+    if(elapsed>0){
+        DecayFactor decay=decayPower(layer->sharedDecay ? &layer->decay : &layer->neuronDecay[neuronNumber],elapsed);
+        potential_t potential=layer->potential[neuronNumber], reset=layer->reset[neuronNumber];
+#if NEURON_FIXED_POINT
+        layer->potential[neuronNumber]=fixed_lif_decay(potential,reset,decay.multiplier,decay.shift);
+#else
+        layer->potential[neuronNumber]=reset+(potential-reset)*decay.factor;
+#endif
+        layer->lastStep[neuronNumber]=step;
     }
-} 
+}
+
+
+
+#if SPARSE_WEIGHTS
+/**
+* @brief Scatter of the CSC columns of the spiking sources, with the list of the neurons they reach.
+*
+* As sparseScatter, but a neuron reached for the first time in the timestep is brought to the end of the
+step before, its current is cleared and it is appended to touched, so only the neurons that have a weight
+from a spiking source are visited.
+*
+* @param layer The layer
+* @param touched Neurons reached in this timestep, written from touched[0]
+* @param begin First neuron of the block
+* @param end Neuron after the last of the block
+* @return Number of neurons reached
+*/
+
+static int lazyScatter(LayerInstanziation* layer, int* touched, int begin, int end)
+{
+    const SpikeList* list=layer->inputEvents;
+    const SparseWeights* columns=&layer->sparse;
+    int count=0;
+    for(int b=0;b<list->blocks;b++){
+        const int* index=list->index+b*list->blockSize;
+        for(int s=0;s<list->count[b];s++){
+            int low=columns->start[index[s]], high=columns->start[index[s]+1];
+            while(low<high){
+                int middle=(low+high)/2;
+                if(columns->index[middle]<begin){
+                    low=middle+1;
+                } else {
+                    high=middle;
+                }
+            }
+            for(int k=low;k<columns->start[index[s]+1] && columns->index[k]<end;k++){
+                int neuronNumber=columns->index[k];
+                if(layer->lastStep[neuronNumber]!=layer->step){
+                    lazyAdvance(layer,neuronNumber,layer->step-1);
+                    layer->lastStep[neuronNumber]=layer->step;
+                    layer->current[neuronNumber]=0;
+                    touched[count++]=neuronNumber;
+                }
+                layer->current[neuronNumber]+=columns->value[k];
+            }
+        }
+    }
+    return count;
+}
+#endif
+
+
+
+/**
+* @brief Lazy simulation of a block of neurons of a layer.
+*
+* Only the neurons that receive a current in this timestep are updated: the leak of their silent timesteps
+is applied by lazyAdvance, then they get the current and the update of one timestep as usual, and the ones
+that spike are written in the output and compacted in the spike list of the block. The neurons reached are
+listed in the slice of the block of the spike list itself, the spikes are never more than them.
+With the dense columns every neuron of the block is reached as soon as a source spiked, with the CSC columns
+only the neurons with a weight from a spiking source are (see lazyScatter).
+A neuron can only spike without input when its threshold isn't above the reset, so such a layer is simulated
+as usual. At the TRACE_NEURON level the state of every neuron is read, so all of them are brought to this
+timestep and the trace is the same of the simulation without LAZY_DECAY.
+*
+* @param layer The layer to simulate.
+* @param block Number of the block in the spike list of the layer
+* @param range Neurons of the block
+*/
+
+static void lazyBlock(LayerInstanziation* layer, int block, Range range)
+{
+    if(layer->parameters.threshold<=layer->parameters.reset){
+        simulateLayer(layer,range.begin,range.end);
+        publishBlock(layer,block,range);
+        return;
+    }
+    int* touched=layer->outputEvents->index+range.begin;
+    int count=0;
+#if SPARSE_WEIGHTS
+    count=lazyScatter(layer,touched,range.begin,range.end);
+#else
+    const SpikeList* list=layer->inputEvents;
+    int sources=0;
+    for(int b=0;b<list->blocks;b++){
+        sources+=list->count[b];
+    }
+    if(sources>0){
+        for(int neuronNumber=range.begin;neuronNumber<range.end;neuronNumber++){
+            lazyAdvance(layer,neuronNumber,layer->step-1);
+            layer->lastStep[neuronNumber]=layer->step;
+            layer->current[neuronNumber]=0;
+            touched[count++]=neuronNumber;
+        }
+        spikeListScatter(list,layer->weights,layer->weightStride,layer->current,range.begin,range.end);
+    }
+#endif
+    int spikes=0;
+    for(int k=0;k<count;k++){
+        int neuronNumber=touched[k];
+        layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],layer->current[neuronNumber]);
+        update_neuron(layer,neuronNumber,layer->sharedDecay ? &layer->decay : &layer->neuronDecay[neuronNumber]);
+        if(layer->spiked[neuronNumber]){
+#if SPIKE_PACKED
+            layer->output[neuronNumber/spikeWordBits]|=(spike_word_t)1<<(neuronNumber%spikeWordBits);
+#else
+            layer->output[neuronNumber]=1;
+#endif
+            touched[spikes++]=neuronNumber;
+        }
+    }
+    layer->outputEvents->count[block]=spikes;
+    benchSpikesAdd(pi_core_id(),layer->index+1,spikes);
+#if SNN_TRACE_LEVEL >= TRACE_NEURON
+    for(int i=range.begin;i<range.end;i++){
+        if(layer->lastStep[i]!=layer->step){
+            lazyAdvance(layer,i,layer->step);
+            layer->spiked[i]=0;
+        }
+        traceNeuron(layer->step,layer->index,i,POTENTIAL_TO_TRACE(layer->potential[i]),layer->spiked[i],
+                "Neuron -> %d, potential: %.2f, threshold: %.2f, spiked: %d\n",
+                i, POTENTIAL_TO_DOUBLE(layer->potential[i]), POTENTIAL_TO_DOUBLE(layer->threshold[i]), layer->spiked[i]);
+    }
+#endif
+}
+#endif
+
+
 
+/**
+* @brief Simulation of a block of neurons of a layer.
+*
+* We call for the block the simulateLayer function, then publishBlock.
+With LAZY_DECAY the block is simulated by lazyBlock instead.
+*
+* @param layer The layer to simulate.
+* @param block Number of the block in the spike list of the layer
+* @param range Neurons of the block
+*/
+
+static inline void simulateBlock(LayerInstanziation* layer, int block, Range range)
+{
+#if LAZY_DECAY
+    lazyBlock(layer,block,range);
+#else
+    simulateLayer(layer,range.begin,range.end);
+    publishBlock(layer,block,range);
+#endif
+}
 
 
+
+#if SPLIT_REDUCTION && !EVENT_DRIVEN && !SPARSE_WEIGHTS
+// Partial synaptic currents of the split accumulation, a row for every core
+static int splitPartial[partitionMaxCores][SPLIT_MAX_NEURONS];
+
+
+
+#if WEIGHT_TILING
+/**
+* @brief Split synaptic accumulation of a layer with the weights streamed from L2.
+*
+* The slice of inputs [first,last) of the core is a run of every row, that the core copies in L1
+with the cluster DMA one piece at a time, in its two buffers: while the piece k is accumulated,
+the piece k+1 is transferred. A piece is the slice of a row, or a tile of it when the slice is longer:
+the layer being narrow, its rows are few and long.
+A piece is a whole number of weight_t, so with 4 bit weights it can start one weight before first.
+*
+* @param layer The layer to simulate
+* @param first First input of the slice
+* @param last Input after the last of the slice
+* @param partial Partial currents of the neurons of the layer
+*/
+
+static void accumulateSplitTiled(LayerInstanziation* layer, int first, int last, int* partial)
+{
+    weight_t* buffer[2];
+    buffer[0]=weightTiles+pi_core_id()*2*weightTileUnits;
+    buffer[1]=buffer[0]+weightTileUnits;
+    for(int neuronNumber=0;neuronNumber<layer->neuronNumber;neuronNumber++){
+        partial[neuronNumber]=0;
+    }
+    if(first>=last){
+        return;
+    }
+    //First weight copied of every row, and number of weights of the slice of a row and of a piece
+    int start=first-first%weightsPerUnit;
+    int slice=last-start;
+    int tileWeights=weightTileWeights;
+    int pieces=(slice+tileWeights-1)/tileWeights;
+    int total=layer->neuronNumber*pieces;
+    pi_cl_dma_copy_t copy;
+    copy.dir=PI_CL_DMA_DIR_EXT2LOC;
+    copy.merge=0;
+    for(int piece=-1;piece<total;piece++){
+        if(piece>=0){
+            pi_cl_dma_wait(&copy);
+        }
+        if(piece+1<total){
+            int row=(piece+1)/pieces;
+            int from=(piece+1)%pieces*tileWeights;
+            int count=slice-from<tileWeights ? slice-from : tileWeights;
+            copy.ext=(uintptr_t)weightAt(layer->weights,row*layer->weightStride+start+from);
+            copy.loc=(uintptr_t)buffer[(piece+1)&1];
+            copy.size=(count+weightsPerUnit-1)/weightsPerUnit*sizeof(weight_t);
+            pi_cl_dma_memcpy(&copy);
+        }
+        if(piece>=0){
+            //The inputs of the piece, the weights before first skipped
+            int from=piece%pieces*tileWeights;
+            int count=slice-from<tileWeights ? slice-from : tileWeights;
+            int skip=from==0 ? first-start : 0;
+            partial[piece/pieces]+=accumulateSegment(layer->input,start+from+skip,count-skip,buffer[piece&1],skip);
+        }
+    }
+}
+#endif
+
 /**
-* @brief Simulation of the first layer.
+* @brief Simulation of a narrow layer with the synaptic accumulation split among the cores.
 *
-* This function takes the first layer and will run the simulation for every neuron of the layer.
-This function will be executed on the eight parallel cores, and will stop only when all the neurons 
-of the layer are simulated correctly.
-We call for every neuron the simulateFirstLayer function.
+* Every core accumulates, for every neuron of the layer, the current of its slice of the inputs
+(of whole words with bit-packed spikes) in its row of splitPartial.
+With WEIGHT_TILING the slices of the rows are streamed from L2 by accumulateSplitTiled.
+After a barrier, every core adds up the rows for the neurons of its block of the static partition
+and updates their membrane.
+This function will be executed on the parallel cores, all of them must call it.
 *
-* @param layer The layer to simulate, in this case the first one.
+* @param layer The layer to simulate.
+* @param cores Number of cores
 */
 
+static void simulateSplitLayer(LayerInstanziation* layer, int cores)
+{
+    int core_id=pi_core_id();
+    Range inputs=partitionStatic(spikeBuffer(layer->num_inputs),core_id,cores,1);
+    int* partial=splitPartial[core_id];
+#if WEIGHT_BITS < 32 || WEIGHT_TILING
+    //First and last input of the slice, that is made of words with bit-packed spikes
+    int first=inputs.begin*(SPIKE_PACKED ? spikeWordBits : 1);
+    int last=inputs.end*(SPIKE_PACKED ? spikeWordBits : 1);
+    last=last<layer->num_inputs ? last : layer->num_inputs;
+#endif
+#if WEIGHT_TILING
+    accumulateSplitTiled(layer,first,last,partial);
+#else
+    for(int neuronNumber=0;neuronNumber<layer->neuronNumber;neuronNumber++){
+        const weight_t* weights=weightAt(layer->weights,neuronNumber*layer->weightStride);
+#if WEIGHT_BITS < 32
+        partial[neuronNumber]=first<last ? accumulateSegment(layer->input,first,last-first,weights,first) : 0;
+#elif SPIKE_PACKED
+        partial[neuronNumber]=spikeAccumulate(layer->input+inputs.begin,inputs.end-inputs.begin,
+                weights+inputs.begin*spikeWordBits);
+#else
+        int input_current=0;
+        for (int j = inputs.begin; j < inputs.end; j++) {
+            if (layer->input[j] == 1) {
+                input_current+=weights[j];
+            }
+        }
+        partial[neuronNumber]=input_current;
+#endif
+    }
+#endif
+    pi_cl_team_barrier();
+    Range range=partitionStatic(layer->neuronNumber,core_id,cores,neuronBlock);
+    if(range.begin<range.end){
+        for(int neuronNumber=range.begin;neuronNumber<range.end;neuronNumber++){
+            int input_current=0;
+            for(int c=0;c<cores;c++){
+                input_current+=splitPartial[c][neuronNumber];
+            }
+            layer->potential[neuronNumber]=POTENTIAL_ADD_INT(layer->potential[neuronNumber],
+                    weightScaled(layer,neuronNumber,input_current));
+        }
+        membraneUpdate(layer,range.begin,range.end);
+        publishBlock(layer,0,range);
+    }
+}
+#endif
+
+
 
-void cluster_simulationFirstLayer(LayerInstanziation* layer) 
+/**
+* @brief Simulation of a layer.
+*
+* This function takes one layer and will run the simulation for every neuron of the layer.
+This function will be executed on the parallel cores, and every core simulates a contiguous chunk of neurons,
+whose size is a multiple of the vector size, so the membrane update works on whole vectors, 
+and of the word size with bit-packed spikes, so every output word is written by a single core.
+In the dynamic partition, the cores instead take blocks of partitionGrain neurons until the layer is done,
+so the work of a slow core is taken by the others.
+In the event-driven propagation, the blocks of the spike list of the layer are the blocks of the partition.
+A layer too narrow to keep the cores busy (see partitionSplit) is simulated by simulateSplitLayer instead,
+the cores share the inputs rather than the neurons.
+*
+* @param layer The layer to simulate.
+*/
+
+void cluster_simulationLayer(LayerInstanziation* layer) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id();  
-    int iterationNumber=gap_muls(iteration,8);
-    while(layer->neuronNumber>iterationNumber){
-        //printf("%d\n",layer->input[0]);
-        simulateFirstLayer(layer,core_id,iteration,layer->num_inputs);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+    PerfSample sample;
+    perfBegin(&sample);
+#if SPLIT_REDUCTION && !EVENT_DRIVEN && !SPARSE_WEIGHTS
+    if(partitionSplit(layer->neuronNumber,spikeBuffer(layer->num_inputs),pi_cl_cluster_nb_cores(),neuronBlock)){
+        simulateSplitLayer(layer,pi_cl_cluster_nb_cores());
+        perfEnd(perfLayer(layer->index),&sample);
+        return;
+    }
+#endif
+#if DYNAMIC_PARTITION
+    int chunk = partitionGrain;
+#else
+    int cores = pi_cl_cluster_nb_cores();
+    int chunk = partitionChunk(layer->neuronNumber,cores,neuronBlock);
+#endif
+#if EVENT_DRIVEN
+    if(pi_core_id()==0){
+        layer->outputEvents->blockSize=chunk;
+        layer->outputEvents->blocks=(layer->neuronNumber+chunk-1)/chunk;
     }
+#endif
+#if DYNAMIC_PARTITION
+    Range range;
+    while(partitionNext(&layer->nextBlock,layer->neuronNumber,chunk,&range)){
+        simulateBlock(layer,range.begin/chunk,range);
+    }
+#else
+    Range range=partitionStatic(layer->neuronNumber,pi_core_id(),cores,neuronBlock);
+    if(range.begin<range.end){
+        simulateBlock(layer,range.begin/chunk,range);
+    }
+#endif
+    perfEnd(perfLayer(layer->index),&sample);
 } 
 
 
 
+
 /**
-* @brief Simulation of the second layer.
+* @brief Fused simulation of the entire network.
 *
-* This function takes the second layer and will run the simulation for every neuron of the layer.
-This function will be executed on the eight parallel cores, and will stop only when all the neurons 
-of the layer are simulated correctly.
-We call for every neuron the simulateSecondLayer function.
+* This function runs all the timesteps of the simulation inside a single cluster task.
+For every timestep, the cores reset the output of every layer and core 0 loads the primary inputs, 
+then they simulate all layers back-to-back. The simulation ends with the frames of the input source. Phases are separated only by a team barrier, 
+because the layer l needs the complete output of the layer l-1, so we don't pay anymore 
+the offload of a task and the fork/join of the team for every layer of every timestep.
+With SNN_PERF, the time every core waits at the barriers is counted apart, it is the load imbalance
+of the phase before; it is only measured here, the non-fused loop joins the team at the end of every task.
 *
-* @param layer The layer to simulate, in this case the second one.
+* @param network The network to simulate.
 */
 
-void cluster_simulationSecondLayer(LayerInstanziation* layer) 
+void cluster_simulationNetwork(NetworkInstanziation* network) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    int iterationNumber=gap_muls(iteration,8); 
-    while(layer->neuronNumber>iterationNumber){
-        simulateSecondLayer(layer,core_id,iteration,layer->num_inputs);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+    uint32_t core_id = pi_core_id(); 
+    PerfSample sample;
+    while(1){
+        if(core_id==0){
+            perfBegin(&sample);
+            loadInput(network);
+            perfEnd(PERF_INPUT,&sample);
+            if(network->running){
+                traceSummary("\n\n------------------------Timestep %d-----------------------\n\n",network->step);
+            }
+        }
+        //initialize output of the neuron layers
+        for(int l=0;l<network->layerNumber;l++){
+            cluster_outputInstanziation(&network->layers[l]);
+        }
+        perfBegin(&sample);
+        pi_cl_team_barrier();
+        perfEnd(PERF_BARRIER,&sample);
+        if(!network->running){
+            break;
+        }
+        for(int l=0;l<network->layerNumber;l++){
+            cluster_simulationLayer(&network->layers[l]);
+            perfBegin(&sample);
+            pi_cl_team_barrier();
+            perfEnd(PERF_BARRIER,&sample);
+        }
     }
 } 
 
 
 
+#if PIPELINE_LAYERS
+/**
+* @brief Groups of cores of the pipelined simulation.
+*
+* With at least as many cores as layers, every layer gets a contiguous group of at least one core,
+and every other core goes to the layer with the highest cost, neurons times inputs, per core of its group.
+With fewer cores, every core simulates whole layers, a contiguous run of the layers.
+This function is executed by a single core.
+*
+* @param network The network
+* @param cores Number of cores of the team
+*/
+
+static void pipelineGroups(NetworkInstanziation* network, int cores)
+{
+    int layerNumber=network->layerNumber;
+    if(cores<layerNumber){
+        for(int l=0;l<layerNumber;l++){
+            network->layers[l].firstCore=l*cores/layerNumber;
+            network->layers[l].coreCount=1;
+        }
+        return;
+    }
+    for(int l=0;l<layerNumber;l++){
+        network->layers[l].coreCount=1;
+    }
+    for(int c=layerNumber;c<cores;c++){
+        int heaviest=0;
+        double heaviestCost=-1.0;
+        for(int l=0;l<layerNumber;l++){
+            LayerInstanziation* layer=&network->layers[l];
+            double cost=(double)layer->neuronNumber*layer->num_inputs/layer->coreCount;
+            if(cost>heaviestCost){
+                heaviest=l;
+                heaviestCost=cost;
+            }
+        }
+        network->layers[heaviest].coreCount++;
+    }
+    int first=0;
+    for(int l=0;l<layerNumber;l++){
+        network->layers[l].firstCore=first;
+        first+=network->layers[l].coreCount;
+    }
+}
+
+
 
- 
 /**
-* @brief Simulation of the third layer.
+* @brief Pipelined simulation of the entire network.
 *
-* This function takes the third layer and will run the simulation for every neuron of the layer.
-This function will be executed on the eight parallel cores, and will stop only when all the neurons 
-of the layer are simulated correctly. 
-We call for every neuron the simulateThirdLayer function.
+* The layer l of the timestep t only needs the layer l-1 of the same timestep and its own state, so
+the layers run as a wavefront: in the step s, the layer l simulates the timestep s-l, on its own group
+of cores (see pipelineGroups). The layer l writes its output in the buffer s%2 while the layer l+1 reads
+the buffer written in the step before, so all the layers of a step only need one barrier between them,
+and a deep network fed by a long spike train keeps all its layers busy at once.
+The pipeline fills in the first layerNumber-1 steps and drains in the last ones, after the last frame.
+The output of a layer is completely written by the membrane update, so it is not reset.
+Core 0 loads the next frame and swaps the buffers between two steps, while the other cores wait.
 *
-* @param layer The layer to simulate, in this case the third one.
+* @param network The network to simulate.
 */
 
-void cluster_simulationThirdLayer(LayerInstanziation* layer) 
+void cluster_pipelineNetwork(NetworkInstanziation* network) 
 { 
-    uint32_t iteration=0;
-    uint32_t core_id = pi_core_id(), cluster_id = pi_cluster_id(); 
-    int iterationNumber=gap_muls(iteration,8); 
-    while(layer->neuronNumber>iterationNumber){
-        simulateThirdLayer(layer,core_id,iteration,layer->num_inputs);
-        iteration++;
-        iterationNumber=gap_muls(iteration,8);
+    int core_id=pi_core_id(); 
+    int layerNumber=network->layerNumber;
+    PerfSample sample;
+    if(core_id==0){
+        pipelineGroups(network,pi_cl_cluster_nb_cores());
+    }
+    for(int s=0;;s++){
+        if(core_id==0){
+            perfBegin(&sample);
+            if(s==0 || network->running){
+                loadInput(network);
+                if(network->running){
+                    traceSummary("\n\n------------------------Timestep %d-----------------------\n\n",network->step);
+                }
+            }
+            for(int l=0;l<layerNumber;l++){
+                LayerInstanziation* layer=&network->layers[l];
+                layer->output=layer->outputs[s%2];
+                if(l>0){
+                    layer->input=network->layers[l-1].outputs[(s+1)%2];
+                }
+                layer->step=s-l;
+            }
+            perfEnd(PERF_INPUT,&sample);
+        }
+        perfBegin(&sample);
+        pi_cl_team_barrier();
+        perfEnd(PERF_BARRIER,&sample);
+        //Timesteps of the simulation, known once the source has no more frames
+        int timesteps=network->running ? s+1 : network->step+1;
+        if(s-(layerNumber-1)>=timesteps){
+            break;
+        }
+        for(int l=0;l<layerNumber;l++){
+            LayerInstanziation* layer=&network->layers[l];
+            if(s-l<0 || s-l>=timesteps || core_id<layer->firstCore || core_id>=layer->firstCore+layer->coreCount){
+                continue;
+            }
+            perfBegin(&sample);
+            Range range=partitionStatic(layer->neuronNumber,core_id-layer->firstCore,layer->coreCount,neuronBlock);
+            if(range.begin<range.end){
+                simulateBlock(layer,0,range);
+            }
+            perfEnd(perfLayer(l),&sample);
+        }
+        perfBegin(&sample);
+        pi_cl_team_barrier();
+        perfEnd(PERF_BARRIER,&sample);
     }
 } 
+#endif
 
 
 
@@ -561,11 +1419,15 @@ send to the core cluster the request to initialize all the output of the specifi
 
 
 
+
+
+
+
  /**
-* @brief cluster delegation of the first layer's weights instanziation.
+* @brief cluster delegation of the weights instanziation.
 *
-* This function takes the first layer, and calling the cluster_weightsInstanziationFirstLayer function, it will
-send to the core cluster the request to initialize all the weights of the first layer.
+* This function takes one layer, and calling the cluster_weightsInstanziation function, it will
+send to the core cluster the request to initialize all the weights of the specified layer.
 *
 * @param layer The layer of the network to initialize.
 */
@@ -573,108 +1435,453 @@ send to the core cluster the request to initialize all the weights of the first
  void cluster_delegate3(LayerInstanziation* layer) 
  { 
     /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_weightsInstanziationFirstLayer, layer);
+    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_weightsInstanziation, layer);
  } 
 
 
+
+
  /**
-* @brief cluster delegation of the second layer's weights instanziation.
+* @brief cluster delegation of the layer simulation.
 *
-* This function takes the second layer, and calling the cluster_weightsInstanziationSecondLayer function, it will
-send to the core cluster the request to initialize all the weights of the second layer.
+* This function takes one layer, and calling the cluster_simulationLayer function, it will
+send to the core cluster the request to simulate all the neurons of the specified layer.
 *
-* @param layer The layer of the network to initialize.
+* @param layer The layer of the network to simulate.
 */
 
-  void cluster_delegate4(LayerInstanziation* layer) 
+   void cluster_delegate4(LayerInstanziation* layer) 
  { 
     /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_weightsInstanziationSecondLayer, layer);
+    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_simulationLayer, layer);
  } 
 
 
 
 
+
  /**
-* @brief cluster delegation of the third layer's weights instanziation.
+* @brief cluster delegation of the fused simulation of the network.
 *
-* This function takes the third layer, and calling the cluster_weightsInstanziationThirdLayer function, it will
-send to the core cluster the request to initialize all the weights of the third layer.
+* This function takes the whole network, and calling the cluster_simulationNetwork function, it will
+send to the core cluster the request to simulate all the timesteps of the network with a single fork.
 *
-* @param layer The layer of the network to initialize.
+* @param network The network to simulate.
 */
 
-   void cluster_delegate5(LayerInstanziation* layer) 
+   void cluster_delegate5(NetworkInstanziation* network) 
  { 
     /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_weightsInstanziationThirdLayer, layer);
+    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_simulationNetwork, network);
  } 
 
 
 
-
+#if PIPELINE_LAYERS
  /**
-* @brief cluster delegation of the first layer simulation.
+* @brief cluster delegation of the pipelined simulation of the network.
 *
-* This function takes the first layer, and calling the cluster_simulationFirstLayer function, it will
-send to the core cluster the request to simulate all the neurons of the specified layer.
+* This function takes the whole network, and calling the cluster_pipelineNetwork function, it will
+send to the core cluster the request to simulate all the timesteps with the layers pipelined.
 *
-* @param layer The layer of the network to simulate.
+* @param network The network to simulate.
 */
 
-   void cluster_delegate6(LayerInstanziation* layer) 
+   void cluster_delegate6(NetworkInstanziation* network) 
  { 
     /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_simulationFirstLayer, layer);
+    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_pipelineNetwork, network);
  } 
+#endif
 
 
 
 
+/**
+* @brief Description of a layer.
+*
+* This function fills the LayerInstanziation struct used by the cluster functions to access a layer.
+The neurons get the standard values of the LIF literature, that a model file can replace.
+*
+* @param layer The layer to describe
+* @param pool Storage of the neurons of the network
+* @param neuronNumber Number of neurons of the layer
+* @param num_inputs Number of inputs of each neuron, equal to the number of neuron of the previous layer
+* @param offset Index of the first neuron of the layer in the neuron arrays, a multiple of the vector size
+* @param weights Weights matrix of the layer, a row of weightStrideOf(num_inputs) weights for every neuron
+* @param input Input of the layer, that is the output of the previous layer, NULL for the first layer
+* @param output Output of the layer
+*/
 
- /**
-* @brief cluster delegation of the second layer simulation.
+void layerDescription(LayerInstanziation* layer, NeuronPool* pool, int neuronNumber, int num_inputs, int offset, weight_t* weights, const spike_t* input, spike_t* output)
+{
+    layer->neuronNumber=neuronNumber;
+    layer->num_inputs=num_inputs;
+    layer->potential=pool->potential+offset;
+    layer->threshold=pool->threshold+offset;
+    layer->reset=pool->reset+offset;
+    layer->neuronDecay=pool->decay+offset;
+    layer->spiked=pool->spiked+offset;
+    layer->weights=weights;
+    layer->parameters.threshold=-50.0;
+    layer->parameters.reset=-65.0;
+    layer->parameters.tau=10.0;
+#if EVENT_DRIVEN
+    layer->weightStride=neuronNumber;
+    layer->current=pool->current+offset;
+#else
+    layer->weightStride=weightStrideOf(num_inputs);
+#endif
+#if WEIGHT_BITS < 32
+    layer->weightScale=pool->scale+offset;
+#endif
+#if LAZY_DECAY
+    layer->lastStep=pool->lastStep+offset;
+#endif
+    layer->sharedDecay=SHARED_DECAY;
+    layer->input=input;
+    layer->output=output;
+    layer->nextBlock=0;
+    layer->step=0;
+    layer->outputs[0]=output;
+    layer->outputs[1]=output;
+}
+
+
+
+#if SPARSE_WEIGHTS
+/**
+* @brief Pruning of the weights of a layer.
 *
-* This function takes the second layer, and calling the cluster_simulationSecondLayer function, it will
-send to the core cluster the request to simulate all the neurons of the specified layer.
+* The dense weights are pruned by magnitude, with PRUNE_THRESHOLD, into the sparse weights of the layer:
+the CSR rows of its neurons, or the CSC columns of its inputs in the event-driven propagation.
 *
-* @param layer The layer of the network to simulate.
+* @param layer The layer, already described
+* @param dense Dense weights, the weight of the neuron n and of the input i is dense[n*neuronStride+i*inputStride]
+* @param neuronStride Distance between the weights of two consecutive neurons
+* @param inputStride Distance between the weights of two consecutive inputs
+* @param start Storage of the start of every line, one more than the lines
+* @param index Storage of the index of the weights kept
+* @param value Storage of the weights kept
+* @return Number of weights kept
 */
 
-   void cluster_delegate7(LayerInstanziation* layer) 
- { 
-    /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_simulationSecondLayer, layer);
- } 
+int layerSparse(LayerInstanziation* layer, const int32_t* dense, int neuronStride, int inputStride, int* start, int* index, int* value)
+{
+    layer->sparse.start=start;
+    layer->sparse.index=index;
+    layer->sparse.value=value;
+    return sparsePrune(dense,layer->neuronNumber,layer->num_inputs,neuronStride,inputStride,PRUNE_THRESHOLD,EVENT_DRIVEN,&layer->sparse);
+}
+#endif
 
 
 
+#if EVENT_DRIVEN
+/**
+* @brief Spike lists of the event-driven propagation.
+*
+* The spike list of a layer is the input list of the next one, and the first layer takes the list
+of the primary inputs. The list of a layer uses the slice of the layer in the event arrays of the pool.
+*
+* @param network The network
+* @param pool Storage of the neurons of the network
+* @param events The numberOfLayers+1 spike lists to connect
+* @param inputIndex Storage of the spike list of the primary inputs, one int for every input
+*/
 
- 
- /**
-* @brief cluster delegation of the third layer simulation.
+void layerEvents(NetworkInstanziation* network, NeuronPool* pool, SpikeList* events, int* inputIndex)
+{
+    events[0].index=inputIndex;
+    events[0].count=inputEventCount;
+    events[0].blockSize=network->layers[0].num_inputs;
+    events[0].blocks=1;
+    for(int l=0;l<network->layerNumber;l++){
+        LayerInstanziation* layer=&network->layers[l];
+        int offset=layer->potential-pool->potential;
+        events[l+1].index=pool->event+offset;
+        events[l+1].count=pool->eventCount+offset;
+        layer->inputEvents=&events[l];
+        layer->outputEvents=&events[l+1];
+    }
+}
+#endif
+
+
+
+/**
+* @brief Network described by a model file.
 *
-* This function takes the third layer, and calling the cluster_simulationThirdLayer function, it will
-send to the core cluster the request to simulate all the neurons of the specified layer.
+* The layers, the storage of their neurons and their spike buffers are allocated from a single arena,
+sized for the model, and the parameters and the weights come from the file, so the weights
+don't need to be instanziated. On host the weights are used in place from the mapped file,
+on target they are read from flash. In the event-driven propagation they are transposed in the arena,
+because the file stores them row-major. With WEIGHT_BITS < 32, quantized weights of the same bits are
+used like int32 ones, with their scales copied, and the others are quantized in the arena.
+Quantized weights of a different type are expanded to int32 in the arena for the other modes.
+With SPARSE_WEIGHTS they are pruned in the arena, sized by a first pass that counts the weights kept;
+on target the dense weights of a layer are read in a scratch arena, released at the end.
+The inputs of the first layer are the primary inputs, so the model also gives their number.
 *
-* @param layer The layer of the network to simulate.
+* @param model The opened model
+* @param arena The arena to allocate
+* @param network The network to fill
+* @return 0 on success, -1 on error
 */
 
-    void cluster_delegate8(LayerInstanziation* layer) 
- { 
-    /* Task dispatch to cluster cores. */ 
-    pi_cl_team_fork(pi_cl_cluster_nb_cores(), cluster_simulationThirdLayer, layer);
- } 
+int networkFromModel(SnnModel* model, ModelArena* arena, NetworkInstanziation* network)
+{
+    int layerNumber=model->header.layerCount;
+    if(model->header.neuronModel!=SNN_MODEL_LIF){
+        printf("Model: the network must be LIF\n");
+        return -1;
+    }
+    //The arena is sized with the same allocations done below
+    size_t poolSize=0,bytes;
+    for(int l=0;l<layerNumber;l++){
+        poolSize+=alignedLayer(model->layers[l].neuronNumber);
+    }
+    bytes=modelArenaBytes(layerNumber*sizeof(LayerInstanziation))+3*modelArenaBytes(poolSize*sizeof(potential_t))
+         +modelArenaBytes(poolSize*sizeof(DecayFactor))+modelArenaBytes(poolSize*sizeof(int));
+#if WEIGHT_BITS < 32
+    bytes+=modelArenaBytes(poolSize*sizeof(int));
+#endif
+#if EVENT_DRIVEN
+    bytes+=3*modelArenaBytes(poolSize*sizeof(int))+modelArenaBytes((layerNumber+1)*sizeof(SpikeList))
+          +modelArenaBytes(model->layers[0].num_inputs*sizeof(int));
+#endif
+#if LAZY_DECAY
+    bytes+=modelArenaBytes(poolSize*sizeof(int));
+#endif
+#if SPARSE_WEIGHTS
+    ModelArena scratch={0};
+    size_t scratchBytes=0;
+    for(int l=0;l<layerNumber;l++){
+        scratchBytes=modelLayerWeights32Bytes(model,l)>scratchBytes ? modelLayerWeights32Bytes(model,l) : scratchBytes;
+    }
+    if(scratchBytes>0 && modelArenaInit(&scratch,scratchBytes)){
+        printf("Model: cannot allocate %u bytes\n",(unsigned)scratchBytes);
+        return -1;
+    }
+    for(int l=0;l<layerNumber;l++){
+        const SnnModelLayer* record=&model->layers[l];
+        scratch.used=0;
+        const int32_t* weights=modelLayerWeights32(model,l,&scratch);
+        if(weights==NULL){
+            printf("Model: cannot read the weights of layer %d\n",l);
+            return -1;
+        }
+        int kept=sparseCount(weights,record->neuronNumber,record->num_inputs,record->num_inputs,1,PRUNE_THRESHOLD);
+        int lines=EVENT_DRIVEN ? record->num_inputs : record->neuronNumber;
+        bytes+=modelArenaBytes((lines+1)*sizeof(int))+2*modelArenaBytes(kept*sizeof(int));
+    }
+#endif
+    for(int l=0;l<layerNumber;l++){
+        bytes+=modelArenaBytes(spikeBuffer(model->layers[l].neuronNumber)*sizeof(spike_t));
+#if PIPELINE_LAYERS
+        bytes+=modelArenaBytes(spikeBuffer(model->layers[l].neuronNumber)*sizeof(spike_t));
+#endif
+#if SPARSE_WEIGHTS
+#elif EVENT_DRIVEN
+        bytes+=modelLayerWeights32Bytes(model,l)
+              +modelArenaBytes((size_t)model->layers[l].neuronNumber*model->layers[l].num_inputs*sizeof(int));
+#elif WEIGHT_BITS < 32
+        if(modelWeightBits(model->header.weightType)==WEIGHT_BITS){
+            bytes+=modelLayerWeightsBytes(model,l)+modelLayerScalesBytes(model,l);
+        }else{
+            bytes+=modelLayerWeights32Bytes(model,l)
+                  +modelArenaBytes((size_t)model->layers[l].neuronNumber*weightStrideOf(model->layers[l].num_inputs)/weightsPerUnit*sizeof(weight_t));
+        }
+#else
+        bytes+=modelLayerWeights32Bytes(model,l);
+#endif
+    }
+    if(modelArenaInit(arena,bytes)){
+        printf("Model: cannot allocate %u bytes\n",(unsigned)bytes);
+        return -1;
+    }
+
+    NeuronPool pool={0};
+    network->layerNumber=layerNumber;
+    network->layers=modelArenaAlloc(arena,layerNumber*sizeof(LayerInstanziation));
+    pool.potential=modelArenaAlloc(arena,poolSize*sizeof(potential_t));
+    pool.threshold=modelArenaAlloc(arena,poolSize*sizeof(potential_t));
+    pool.reset=modelArenaAlloc(arena,poolSize*sizeof(potential_t));
+    pool.decay=modelArenaAlloc(arena,poolSize*sizeof(DecayFactor));
+    pool.spiked=modelArenaAlloc(arena,poolSize*sizeof(int));
+#if WEIGHT_BITS < 32
+    pool.scale=modelArenaAlloc(arena,poolSize*sizeof(int));
+#endif
+#if EVENT_DRIVEN
+    pool.current=modelArenaAlloc(arena,poolSize*sizeof(int));
+    pool.event=modelArenaAlloc(arena,poolSize*sizeof(int));
+    pool.eventCount=modelArenaAlloc(arena,poolSize*sizeof(int));
+#endif
+#if LAZY_DECAY
+    pool.lastStep=modelArenaAlloc(arena,poolSize*sizeof(int));
+#endif
+    spike_t* input=NULL;
+    int offset=0;
+    for(int l=0;l<layerNumber;l++){
+        const SnnModelLayer* record=&model->layers[l];
+        LayerInstanziation* layer=&network->layers[l];
+        spike_t* output=modelArenaAlloc(arena,spikeBuffer(record->neuronNumber)*sizeof(spike_t));
+#if SPARSE_WEIGHTS
+        scratch.used=0;
+        const int32_t* weights=modelLayerWeights32(model,l,&scratch);
+#elif WEIGHT_BITS < 32
+        //The rows of quantized weights of the same bits have the layout of the engine
+        int stored=modelWeightBits(model->header.weightType)==WEIGHT_BITS;
+        const void* weights=stored ? modelLayerWeights(model,l,arena) : modelLayerWeights32(model,l,arena);
+#else
+        const int32_t* weights=modelLayerWeights32(model,l,arena);
+#endif
+        if(weights==NULL){
+            printf("Model: cannot read the weights of layer %d\n",l);
+            return -1;
+        }
+#if SPARSE_WEIGHTS
+        //The dense weights are row-major, the sparse ones keep only the weights left by the pruning
+        int kept=sparseCount(weights,record->neuronNumber,record->num_inputs,record->num_inputs,1,PRUNE_THRESHOLD);
+        int lines=EVENT_DRIVEN ? record->num_inputs : record->neuronNumber;
+        layerDescription(layer,&pool,record->neuronNumber,record->num_inputs,offset,NULL,input,output);
+        layerSparse(layer,weights,layer->num_inputs,1,modelArenaAlloc(arena,(lines+1)*sizeof(int)),
+                modelArenaAlloc(arena,kept*sizeof(int)),modelArenaAlloc(arena,kept*sizeof(int)));
+#elif EVENT_DRIVEN
+        int* columns=modelArenaAlloc(arena,(size_t)record->neuronNumber*record->num_inputs*sizeof(int));
+        layerDescription(layer,&pool,record->neuronNumber,record->num_inputs,offset,columns,input,output);
+        for(int n=0;n<layer->neuronNumber;n++){
+            for(int i=0;i<layer->num_inputs;i++){
+                columns[weightIndex(layer,n,i)]=weights[n*layer->num_inputs+i];
+            }
+        }
+#elif WEIGHT_BITS < 32
+        //Otherwise every row of the file is quantized with the scale of its neuron
+        const int32_t* scales=stored ? modelLayerScales(model,l,arena) : NULL;
+        weight_t* rows=stored ? (weight_t*)weights
+                : modelArenaAlloc(arena,(size_t)record->neuronNumber*weightStrideOf(record->num_inputs)/weightsPerUnit*sizeof(weight_t));
+        if(stored && scales==NULL){
+            printf("Model: cannot read the scales of layer %d\n",l);
+            return -1;
+        }
+        layerDescription(layer,&pool,record->neuronNumber,record->num_inputs,offset,rows,input,output);
+        for(int n=0;n<layer->neuronNumber;n++){
+            layer->weightScale[n]=stored ? scales[n]
+                    : quantizeRow((const int32_t*)weights+(size_t)n*layer->num_inputs,layer->num_inputs,layer->weightStride,
+                            weightAt(rows,n*layer->weightStride));
+        }
+#else
+        //The weights are only read by the simulation, so they can stay in the read-only mapping
+        layerDescription(layer,&pool,record->neuronNumber,record->num_inputs,offset,(weight_t*)weights,input,output);
+#endif
+        layer->parameters.threshold=SNN_PARAM_TO_DOUBLE(record->params[SNN_LIF_THRESHOLD]);
+        layer->parameters.reset=SNN_PARAM_TO_DOUBLE(record->params[SNN_LIF_RESET]);
+        layer->parameters.tau=SNN_PARAM_TO_DOUBLE(record->params[SNN_LIF_TAU]);
+#if PIPELINE_LAYERS
+        layer->outputs[1]=modelArenaAlloc(arena,spikeBuffer(record->neuronNumber)*sizeof(spike_t));
+#endif
+        input=output;
+        offset+=alignedLayer(record->neuronNumber);
+    }
+#if EVENT_DRIVEN
+    SpikeList* events=modelArenaAlloc(arena,(layerNumber+1)*sizeof(SpikeList));
+    layerEvents(network,&pool,events,modelArenaAlloc(arena,model->layers[0].num_inputs*sizeof(int)));
+#endif
+#if SPARSE_WEIGHTS
+    modelArenaFree(&scratch);
+#endif
+    return 0;
+}
+
+
+
+/**
+* @brief Source of the primary inputs.
+*
+* On host, the environment variable SNN_INPUT can give a file of spikes (see spikeSource.h).
+On target, SPIKE_FILE can name a file of spikes of the flash filesystem, read one block of frames at a time
+in a ring in L2. Otherwise the source is the input table, converted in frames one block at a time in the same ring.
+When the whole simulation is a single cluster task, the frames of the ring are prefetched in L1 by the cluster DMA.
+The table has neuronFirstLevel inputs, so a model with a different number of inputs needs a file.
+*
+* @param cluster The cluster device
+* @param inputs Number of primary inputs of the network
+* @return The source, or NULL on error
+*/
+
+SpikeSource* inputSource(struct pi_device* cluster, int inputs)
+{
+    static SpikeFramesSource ring;
+#if SPIKE_FILE_SOURCE
+    static SpikeFileSource file;
+    if(getenv("SNN_INPUT")!=NULL){
+        return spikeFileOpen(&file,getenv("SNN_INPUT"),inputs,SPIKE_PACKED) ? NULL : &file.source;
+    }
+#endif
+#if SPIKE_FLASH_SOURCE && defined(SPIKE_FILE)
+    static SpikeFlashProducer flash;
+    if(spikeFlashOpen(&flash,SPIKE_FILE,inputs,SPIKE_RING_BLOCK,SPIKE_PACKED)){
+        return NULL;
+    }
+    if(spikeFramesRing(&ring,spikeFlashRefill,&flash,inputs,SPIKE_RING_BLOCK,SPIKE_PACKED)){
+        spikeFlashClose(&flash);
+        return NULL;
+    }
+    ring.release=spikeFlashClose;
+#else
+    static SpikeTableProducer table;
+    if(inputs!=neuronFirstLevel){
+        printf("The input table has %d inputs, the network %d\n",neuronFirstLevel,inputs);
+        return NULL;
+    }
+    spikeTableProducer(&table,&input[0][0],neuronFirstLevel,timestep,SPIKE_PACKED);
+    if(spikeFramesRing(&ring,spikeTableRefill,&table,inputs,SPIKE_RING_BLOCK,SPIKE_PACKED)){
+        return NULL;
+    }
+#endif
+#if FUSED_TIMESTEP
+    if(spikeFramesPrefetch(&ring,cluster)){
+        return NULL;
+    }
+#else
+    (void)cluster;
+#endif
+    return &ring.source;
+}
+
+
+
+/**
+* @brief Path of the model file of the network, NULL to simulate the network described at compile time.
+*
+* On host it is the environment variable SNN_MODEL, on target the file MODEL_FILE of the flash filesystem.
+*/
+
+static const char* modelPath(void)
+{
+#if !SNN_MODEL_FLASH
+    if(getenv("SNN_MODEL")!=NULL){
+        return getenv("SNN_MODEL");
+    }
+#endif
+#ifdef MODEL_FILE
+    return MODEL_FILE;
+#else
+    return NULL;
+#endif
+}
+
 
 
- 
  
 /**
 * @brief Instanziation and simulation of the entire network.
 *
 * This function has no input parameters, it initializes the cluster and cores, we initialize all layers of the network
 we execute all the basic procedure to run the spiking neural network.
-We call, in order, all the cluster delegate used to run all functionalities.
+The network is described by an array of layers, so every phase of the simulation simply iterates over the layers
+calling the cluster delegates. The layers are the ones described at compile time, or the ones of a model file
+when one is given (see modelPath).
 *
 */
  
@@ -685,27 +1892,41 @@ We call, in order, all the cluster delegate used to run all functionalities.
 
     /*We created a struct, called LayerInstanziation, useful in our cluster function,
     because they can accept only one argument. We pass input and output pointer, 
-    number of neurons in the layer and so on*/
-
-    LayerInstanziation secondLayer;
-    secondLayer.neuronNumber=neuronSecondLevel;
-    secondLayer.neuronLayer=secondLevel;
-    secondLayer.output=inputThirdLayer;
-    secondLayer.input=inputSecondLayer;
-    secondLayer.num_inputs=neuronFirstLevel;
-
-    LayerInstanziation firstLayer;
-    firstLayer.neuronNumber=neuronFirstLevel;
-    firstLayer.neuronLayer=firstLevel;
-    firstLayer.output=inputSecondLayer;
-    firstLayer.num_inputs=neuronFirstLevel;
-
-    LayerInstanziation thirdLayer;
-    thirdLayer.neuronNumber=neuronThirdLevel;
-    thirdLayer.neuronLayer=thirdLevel;
-    thirdLayer.output=inputFourthLayer;
-    thirdLayer.input=inputThirdLayer;
-    thirdLayer.num_inputs=neuronSecondLevel;
+    number of neurons in the layer, the weights and so on.
+    The network is the array of all its layers*/
+
+    LayerInstanziation layers[numberOfLayers];
+    NetworkInstanziation network;
+    SnnModel model;
+    ModelArena arena;
+    const char* path=modelPath();
+    int fromModel=path!=NULL;
+
+    if(fromModel){
+        //The network is the one of the model file, and its weights are already trained
+        if(modelOpen(&model,path) || networkFromModel(&model,&arena,&network)){
+            printf("Model %s not loaded !\n",path);
+            pmsis_exit(-1);
+        }
+        modelClose(&model);
+        traceSummary("Model %s: %d layers\n",path,network.layerNumber);
+    }
+    else{
+        network.layerNumber=numberOfLayers;
+        network.layers=layers;
+        layerDescription(&layers[0],&compiledPool,neuronFirstLevel,neuronFirstLevel,0,&weightsFirstLevel[0][0],NULL,inputSecondLayer);
+        layerDescription(&layers[1],&compiledPool,neuronSecondLevel,neuronFirstLevel,alignedLayer(neuronFirstLevel),&weightsSecondLevel[0][0],inputSecondLayer,inputThirdLayer);
+        layerDescription(&layers[2],&compiledPool,neuronThirdLevel,neuronSecondLevel,alignedLayer(neuronFirstLevel)+alignedLayer(neuronSecondLevel),&weightsThirdLevel[0][0],inputThirdLayer,inputFourthLayer);
+#if PIPELINE_LAYERS
+        layers[0].outputs[1]=pipelineSecondLayer;
+        layers[1].outputs[1]=pipelineThirdLayer;
+        layers[2].outputs[1]=pipelineFourthLayer;
+#endif
+#if EVENT_DRIVEN
+        static SpikeList events[numberOfLayers+1];
+        layerEvents(&network,&compiledPool,events,inputEvent);
+#endif
+    }
 
 
     /* Init cluster configuration structure. */ 
@@ -717,55 +1938,100 @@ We call, in order, all the cluster delegate used to run all functionalities.
         printf("Cluster open failed !\n"); 
         pmsis_exit(-1); 
     } 
+#if WEIGHT_TILING
+    weightTiles=pi_l1_malloc(&cluster_dev,partitionMaxCores*2*weightTileUnits*sizeof(weight_t));
+    if(weightTiles==NULL){
+        printf("Weight tiles not allocated !\n");
+        pmsis_exit(-1);
+    }
+#endif
+    network.source=inputSource(&cluster_dev,network.layers[0].num_inputs);
+    network.step=-1;
+    if(network.source==NULL){
+        printf("Input source not available !\n");
+        pmsis_exit(-1);
+    }
     /* Prepare cluster task and send it to cluster. */ 
     struct pi_cluster_task cl_task; 
-    //We can pass only one argument, so the instanziation shoulb be done for every layer?
 
-    //The next three function are called in order to instanziate the first layer of neuron, it can be optimized using a struct
-    printf("-------------------FIRST LAYER----------------------\n");
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, &firstLayer));
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate3, &firstLayer));
-
-
-    printf("-------------------SECOND LAYER----------------------\n");
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, &secondLayer));
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate4, &secondLayer));
-
-    printf("-------------------THIRD LAYER----------------------\n");
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, &thirdLayer));
-    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate5, &thirdLayer));
-    printf("End. Your neuron instanziation:\n"); 
-    printf("\n\n------------------------Start of the simulation-----------------------\n\n");
-    for(int i = 0;i<timestep;i++){
-        printf("\n\n------------------------Timestep %d-----------------------\n\n",i);
+    //Instanziation of the neurons and of the weights of every layer
+#if SPARSE_WEIGHTS
+    int sparseLines=0,sparseSynapses=0;
+#endif
+    for(int l=0;l<network.layerNumber;l++){
+        LayerInstanziation* layer=&network.layers[l];
+        layer->index=l;
+        traceSummary("-------------------LAYER %d----------------------\n",l+1);
+        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate, layer));
+        if(!fromModel){
+            pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate3, layer));
+#if SPARSE_WEIGHTS
+            //The dense weights just instanziated are pruned in the compiled storage
+            sparseSynapses+=layerSparse(layer,layer->weights,weightIndex(layer,1,0),weightIndex(layer,0,1),
+                    sparseStart+sparseLines,sparseIndex+sparseSynapses,sparseValue+sparseSynapses);
+            sparseLines+=layer->sparse.lines+1;
+#endif
+        }
+#if SPARSE_WEIGHTS
+        traceSummary("Layer %d: %d of %d weights kept\n",l+1,layer->sparse.start[layer->sparse.lines],
+                layer->neuronNumber*layer->num_inputs);
+#endif
+    }
+    traceSummary("End. Your neuron instanziation:\n"); 
+    traceSummary("\n\n------------------------Start of the simulation-----------------------\n\n");
+#if SNN_BENCH
+    uint64_t start=benchClock();
+#endif
+#if PIPELINE_LAYERS
+    //All the timesteps are simulated by a single cluster task, with the layers pipelined
+    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate6, &network));
+#elif FUSED_TIMESTEP
+    //All the timesteps are simulated by a single cluster task
+    pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate5, &network));
+#else
+    while(1){
+        loadInput(&network);
+        if(!network.running){
+            break;
+        }
+        traceSummary("\n\n------------------------Timestep %d-----------------------\n\n",network.step);
         //initialize output of the neuron layers
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &firstLayer));
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &secondLayer));
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &thirdLayer));
-        for(int j=0;j<neuronFirstLevel;j++){
-            inputFirstLayer[j]=input[j][i];
-            //right assiignment, the input of the first layer is correctly assigned.
-        }
-        firstLayer.input=inputFirstLayer;
-        //Assignement between vector pointers
-        printf("\n\n------------------------First layer----------------------\n\n");
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate6, &firstLayer));
-        printf("\n\n------------------------Second layer-----------------------\n\n");
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate7, &secondLayer));
-        printf("\n\n------------------------Third layer-----------------------\n\n");
-        pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate8, &thirdLayer));
+        for(int l=0;l<network.layerNumber;l++){
+            pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate2, &network.layers[l]));
+        }
+        for(int l=0;l<network.layerNumber;l++){
+            traceLayer("\n\n------------------------Layer %d----------------------\n\n",l+1);
+            pi_cluster_send_task_to_cl(&cluster_dev, pi_cluster_task(&cl_task, cluster_delegate4, &network.layers[l]));
+        }
 
     }
+#endif
+    traceSummary("\n\n------------------------End of the simulation: %d timesteps-----------------------\n\n",network.step+1);
+#if SNN_BENCH
+    //Every layer receives the spikes of its source, the primary inputs or the previous layer
+    uint64_t elapsed=benchClock()-start,neurons=0,synapticEvents=0;
+    for(int l=0;l<network.layerNumber;l++){
+        neurons+=network.layers[l].neuronNumber;
+        synapticEvents+=benchSpikesOf(l)*network.layers[l].neuronNumber;
+    }
+    benchReport("lif",network.step+1,elapsed,neurons*(network.step+1),synapticEvents);
+#endif
+    traceDump();
+    perfReport(network.step+1);
+    network.source->close(network.source);
+#if WEIGHT_TILING
+    pi_l1_free(&cluster_dev,weightTiles,partitionMaxCores*2*weightTileUnits*sizeof(weight_t));
+#endif
     pi_cluster_close(&cluster_dev); 
     pmsis_exit(0); 
  } 
  
  
-
+ 
 
  /* Program Entry. */ 
  int main(void) 
  { 
-    printf("\n\n\t *** Neuron instanziation ***\n\n"); 
+    traceSummary("\n\n\t *** Neuron instanziation ***\n\n"); 
     return pmsis_kickoff((void *) neuronInstanziation); 
  }
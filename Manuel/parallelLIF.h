@@ -4,6 +4,7 @@
 #define NEURON_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // Neuron structure declaration
 
@@ -20,23 +21,324 @@
 
 #define timestep 2
 
+// Number of layers of the network
+#define numberOfLayers 3
+
+// If 1, all the timesteps are simulated by a single cluster task, with barriers between the layers.
+// If 0, every layer of every timestep is sent to the cluster as a different task.
+#ifndef FUSED_TIMESTEP
+#define FUSED_TIMESTEP 1
+#endif
+
+// If 1, the neuron state is stored in fixed-point (Q16.16 or Q8.8, see fixedPoint.h) and updated
+// with integer operations only, otherwise it is stored in double.
+#ifndef NEURON_FIXED_POINT
+#define NEURON_FIXED_POINT 0
+#endif
+
+#if NEURON_FIXED_POINT
+#include "fixedPoint.h"
+typedef fixed_t potential_t;
+#define POTENTIAL_FROM_DOUBLE(x) FIXED_FROM_DOUBLE(x)
+#define POTENTIAL_TO_DOUBLE(x) FIXED_TO_DOUBLE(x)
+#define POTENTIAL_ADD_INT(p, i) fixed_add_int((p), (i))
+#define POTENTIAL_TO_TRACE(x) ((int32_t)(x) * (1 << (16 - FIXED_FRAC_BITS)))
+#else
+typedef double potential_t;
+#define POTENTIAL_FROM_DOUBLE(x) ((double)(x))
+#define POTENTIAL_TO_DOUBLE(x) ((double)(x))
+#define POTENTIAL_ADD_INT(p, i) ((p) + (i))
+#define POTENTIAL_TO_TRACE(x) ((int32_t)((x) * 65536.0))
+#endif
+
+// If 1, the neurons of a layer share the same tau, so the decay factor is stored once in the layer
+// and not loaded for every neuron.
+#ifndef SHARED_DECAY
+#define SHARED_DECAY 1
+#endif
+
+// Decay factor exp(-1/tau) of the membrane potential, computed once at the instanziation.
+// In fixed-point it is the pair multiplier/shift, so decay = multiplier / 2^shift.
+typedef struct {
+#if NEURON_FIXED_POINT
+    int32_t multiplier;
+    int shift;
+#else
+    double factor;
+#endif
+} DecayFactor;
+
+// Implementation of the membrane update kernel of a layer:
+// 0 scalar loop
+// 1 GCC vector extensions, compiled to SSE/AVX on host (VECTOR_BYTES wide)
+// 2 GAP8 packed SIMD on v2s, only for the Q8.8 fixed-point model
+#ifndef MEMBRANE_SIMD
+#if defined(__riscv) || defined(__pulp__)
+#if NEURON_FIXED_POINT && FIXED_FRAC_BITS == 8
+#define MEMBRANE_SIMD 2
+#else
+#define MEMBRANE_SIMD 0
+#endif
+#else
+#define MEMBRANE_SIMD 1
+#endif
+#endif
+
+// Size in bytes of the vectors of the membrane update kernel
+#ifndef VECTOR_BYTES
+#if MEMBRANE_SIMD == 2
+#define VECTOR_BYTES 4
+#else
+#define VECTOR_BYTES 32
+#endif
+#endif
+
+// Number of neurons updated together by the membrane update kernel
+#define neuronVectorLanes ((int)(VECTOR_BYTES / sizeof(potential_t)))
+
+// Number of neurons of a layer rounded up to a whole number of vectors, used to lay out the layers
+#define alignedLayer(n) (((n) + neuronVectorLanes - 1) / neuronVectorLanes * neuronVectorLanes)
+
+// Vector of potentials, and vector of the masks produced by comparing two of them.
+// The vectors are only aligned as their elements, so they can be loaded from any neuron.
+#if NEURON_FIXED_POINT
+typedef fixed_t potential_bits_t;
+#else
+typedef int64_t potential_bits_t;
+#endif
+#if MEMBRANE_SIMD
+typedef potential_t potentialVector __attribute__((vector_size(VECTOR_BYTES), aligned(sizeof(potential_t))));
+typedef potential_bits_t potentialMaskVector __attribute__((vector_size(VECTOR_BYTES), aligned(sizeof(potential_t))));
+#endif
+
+// If 1, the spikes exchanged between layers are bit-packed, 32 neurons per word (see spikeVector.h),
+// and the synaptic accumulation only visits the active inputs.
+// If 0, every spike is an int equal to 0 or 1.
+#ifndef SPIKE_PACKED
+#define SPIKE_PACKED 0
+#endif
+
+#include "spikeVector.h"
+#if SPIKE_PACKED
+typedef spike_word_t spike_t;
+#define spikeBuffer(n) spikeWords(n)
+#else
+typedef int spike_t;
+#define spikeBuffer(n) (n)
+#endif
+
+// If 1, the propagation is event-driven: every layer publishes the list of its spiking neurons and
+// the next layer adds only the weight columns of those sources (see spikeList.h).
+// The weights are then stored column-major, one contiguous column for every input.
+#ifndef EVENT_DRIVEN
+#define EVENT_DRIVEN 0
+#endif
+
+// If 1, the layers are pipelined across timesteps: the cores are split in a group for every layer, and in
+// the same step the layer l simulates the timestep t-l, reading the output written by the layer l-1 in the
+// step before from a double buffer (see cluster_pipelineNetwork). Only for the fused dense simulation.
+#ifndef PIPELINE_LAYERS
+#define PIPELINE_LAYERS 0
+#endif
+
+#if PIPELINE_LAYERS && (!FUSED_TIMESTEP || EVENT_DRIVEN)
+#error "PIPELINE_LAYERS needs FUSED_TIMESTEP and the dense propagation"
+#endif
+
+// If 1, every core streams the weight rows of its neurons from L2 into its own double buffer in L1 with
+// the cluster DMA, WEIGHT_TILE_BYTES at a time, and accumulates a tile while the next one is transferred,
+// so the weights don't need to fit in L1. Only for the dense propagation, that reads the weights by rows.
+#ifndef WEIGHT_TILING
+#define WEIGHT_TILING 0
+#endif
+
+// Size of a tile of weights, two tiles for every core are allocated in L1
+#ifndef WEIGHT_TILE_BYTES
+#define WEIGHT_TILE_BYTES 2048
+#endif
+
+#if WEIGHT_TILING && EVENT_DRIVEN
+#error "WEIGHT_TILING needs the dense propagation"
+#endif
+
+// Bits of a stored weight: 32 (int), 8 (int8) or 4 (int4, two in a byte). With 8 and 4 bits the weights of
+// a neuron are stored as q * scale, with an integer scale for every neuron because the weights of the engine
+// are integer currents, so the weights that fit the range of q are exact. Only for the dense propagation.
+#ifndef WEIGHT_BITS
+#define WEIGHT_BITS 32
+#endif
+
+#if WEIGHT_BITS == 32
+typedef int weight_t;
+#define weightGet(weights, j) ((weights)[j])
+#elif WEIGHT_BITS == 8
+typedef int8_t weight_t;
+#define weightGet(weights, j) ((int)(weights)[j])
+#define weightSet(weights, j, q) ((weights)[j] = (weight_t)(q))
+#define weightMax 127
+#elif WEIGHT_BITS == 4
+// The weight j is the low nibble of the byte j/2 if j is even, the high nibble otherwise
+typedef uint8_t weight_t;
+#define weightGet(weights, j) ((int)(int8_t)((weights)[(j) >> 1] << (((j) & 1) ? 0 : 4)) >> 4)
+#define weightSet(weights, j, q) ((weights)[(j) >> 1] = (weight_t)(((weights)[(j) >> 1] & (((j) & 1) ? 0x0f : 0xf0)) \
+                                                       | (((q) & 0xf) << (((j) & 1) ? 4 : 0))))
+#define weightMax 7
+#else
+#error "WEIGHT_BITS must be 32, 8 or 4"
+#endif
+
+#if WEIGHT_BITS < 32 && EVENT_DRIVEN
+#error "Quantized weights need the dense propagation"
+#endif
+
+// Weights stored in a weight_t
+#define weightsPerUnit ((int)(8 * sizeof(weight_t) / WEIGHT_BITS))
+// The rows of quantized weights are padded to 8 weights, so every row starts on a word
+#define weightRowAlign (WEIGHT_BITS < 32 ? 8 : 1)
+#define weightStrideOf(inputs) (((inputs) + weightRowAlign - 1) / weightRowAlign * weightRowAlign)
+// Storage of the weight j of a matrix, j a multiple of weightsPerUnit
+#define weightAt(weights, j) ((weights) + (j) / weightsPerUnit)
+// Weights of a tile of WEIGHT_TILE_BYTES
+#define weightTileUnits ((int)(WEIGHT_TILE_BYTES / sizeof(weight_t)))
+#define weightTileWeights (weightTileUnits * weightsPerUnit)
+
+// Synaptic current of a neuron from the sum of its stored weights
+#if WEIGHT_BITS == 32
+#define weightScaled(layer, neuron, current) (current)
+#else
+#define weightScaled(layer, neuron, current) ((current) * (layer)->weightScale[neuron])
+#endif
+
+// If 1, the int8 dot products use the packed sdotp4 of the PULP extensions, four weights at a time
+#ifndef WEIGHT_SDOTP
+#if defined(__riscv) || defined(__pulp__)
+#define WEIGHT_SDOTP 1
+#else
+#define WEIGHT_SDOTP 0
+#endif
+#endif
+
+// If 1, the weights are pruned by magnitude and stored compressed (see sparseWeights.h): CSR rows for the
+// dense-input propagation, CSC columns for the event-driven one, so the memory and the synaptic work are
+// proportional to the connections left.
+#ifndef SPARSE_WEIGHTS
+#define SPARSE_WEIGHTS 0
+#endif
+
+// The weights with a smaller magnitude are pruned, 1 keeps every connection that isn't 0
+#ifndef PRUNE_THRESHOLD
+#define PRUNE_THRESHOLD 1
+#endif
+
+#if SPARSE_WEIGHTS && (WEIGHT_TILING || WEIGHT_BITS < 32)
+#error "SPARSE_WEIGHTS needs int32 weights without tiling"
+#endif
+
+// If 1, a neuron is updated only in the timesteps in which it receives a current: it keeps the timestep of
+// its last update, and the leak of the silent timesteps in between is applied at once, decay^dt, when the next
+// input arrives or its state is traced. A neuron below the threshold can't spike without input, so the idle
+// neurons are skipped and the cost follows the spikes. Only for the event-driven propagation.
+#ifndef LAZY_DECAY
+#define LAZY_DECAY 0
+#endif
+
+#if LAZY_DECAY && !EVENT_DRIVEN
+#error "LAZY_DECAY needs the event-driven propagation"
+#endif
+
+#include "spikeList.h"
+#include "sparseWeights.h"
+#include "spikeSource.h"
+#include "partition.h"
+
+// Granularity of the blocks of neurons assigned to a core: a whole vector, and with packed spikes
+// a whole word, so that no other core writes the same output word.
+#if SPIKE_PACKED
+#define neuronBlock (neuronVectorLanes > spikeWordBits ? neuronVectorLanes : spikeWordBits)
+#else
+#define neuronBlock neuronVectorLanes
+#endif
+
+// If 1, the cores take the blocks of a layer dynamically, PARTITION_GRAIN neurons at a time (see partition.h),
+// otherwise every core simulates one contiguous chunk of the layer.
+#ifndef DYNAMIC_PARTITION
+#define DYNAMIC_PARTITION 0
+#endif
+
+// Neurons taken at a time in the dynamic partition, rounded up to a block
+#ifndef PARTITION_GRAIN
+#define PARTITION_GRAIN 64
+#endif
+#define partitionGrain ((PARTITION_GRAIN + neuronBlock - 1) / neuronBlock * neuronBlock)
+
+// Parameters used to initialize the neurons of a layer
 typedef struct {
-    double potential;   // Membrane potential
     double threshold;   // Threshold for spike
-    int spiked;         // Spike flag
-    double reset;       // Reset value after spike
-    int num_inputs;     // Number of inputs
-    double tau;         // Time constant for decay (leak)
-} Neuron;
+    double reset;       // Reset value after spike, and rest potential
+    double tau;         // Time constant of the leak, in timesteps
+} NeuronParameters;
 
+/* Storage of the neurons of the network: every field of the neurons is stored in its own array,
+and each layer takes a slice of it starting at a multiple of the vector size. */
 typedef struct {
+    potential_t* potential;
+    potential_t* threshold;
+    potential_t* reset;
+    DecayFactor* decay;
+    int* spiked;
+    int* scale;         // Only with quantized weights
+    int* current;       // Only in the event-driven propagation
+    int* event;         // Only in the event-driven propagation
+    int* eventCount;    // Only in the event-driven propagation
+    int* lastStep;      // Only with LAZY_DECAY
+} NeuronPool;
+
+/* The neurons of a layer are stored as a structure of arrays: the same field of consecutive
+neurons is contiguous in memory, so the membrane update streams through whole vectors of neurons. */
+typedef struct {
+    int index;          // Position of the layer in the network
     int neuronNumber;
     int num_inputs;
-    Neuron* neuronLayer;
-    int* output;
-    int* input;
+    potential_t* potential;     // Membrane potential of every neuron
+    potential_t* threshold;     // Threshold for spike of every neuron
+    potential_t* reset;         // Reset value after spike of every neuron
+    DecayFactor* neuronDecay;   // Decay factor for a timestep, exp(-1/tau), of every neuron
+    int* spiked;                // Spike flag of every neuron
+    spike_t* output;            // Spikes of the layer, input of the next layer
+    const spike_t* input;       // Spikes of the previous layer, or the frame of the primary inputs
+    SpikeList* inputEvents;     // Spikes of the previous layer, in the event-driven propagation
+    SpikeList* outputEvents;    // Spikes of the layer, in the event-driven propagation
+    int* current;               // Synaptic current of every neuron, in the event-driven propagation
+    int* lastStep;              // Timestep of the last update of every neuron, with LAZY_DECAY
+    weight_t* weights;  // Weights matrix, row-major (one row for every neuron), or column-major if EVENT_DRIVEN
+    int weightStride;   // Distance in weights between two rows (or columns) of the weights matrix
+    int* weightScale;   // Scale of the quantized weights of every neuron
+    SparseWeights sparse;   // Pruned weights, CSR rows of the neurons, or CSC columns of the inputs if EVENT_DRIVEN
+    int sharedDecay;    // If 1, every neuron of the layer uses the decay of the layer
+    DecayFactor decay;  // Decay factor shared by the neurons of the layer
+    NeuronParameters parameters;    // Parameters of the neurons, used by the instanziation
+    volatile int nextBlock;         // First neuron not yet taken, in the dynamic partition
+    int step;                       // Timestep simulated by the layer
+    spike_t* outputs[2];            // Output buffers written in alternate steps, in the pipelined simulation
+    int firstCore;                  // First core of the group of the layer, in the pipelined simulation
+    int coreCount;                  // Number of cores of the group of the layer
 } LayerInstanziation;
 
+// Index of the weight between a neuron and one of its inputs
+#if EVENT_DRIVEN
+#define weightIndex(layer, neuron, input) ((input) * (layer)->weightStride + (neuron))
+#else
+#define weightIndex(layer, neuron, input) ((neuron) * (layer)->weightStride + (input))
+#endif
+
+typedef struct {
+    int layerNumber;                // Number of layers of the network
+    LayerInstanziation* layers;     // Layers, in order from the input to the output
+    SpikeSource* source;            // Source of the primary inputs, one frame for every timestep
+    int running;                    // 0 when the source has no more frames
+    int step;                       // Timestep being simulated
+} NetworkInstanziation;
+
 // Function prototypes
 /*
 void update_neuron(Neuron* n, int numberNeuron, int* inputNextLayer);
@@ -0,0 +1,126 @@
+/**
+ * @file partition.h
+ * @brief Distribution of the neurons of a layer among the cluster cores.
+ *
+ * The neurons are given to the cores as contiguous ranges [begin,end), so a core writes a contiguous
+ * slice of every array of the layer: no two cores write the same cache line on host, and on GAP8 the
+ * accesses of a core stay on consecutive TCDM banks instead of interleaving with the other cores.
+ * The number of cores is the one of the team, pi_cl_cluster_nb_cores(), so any count works.
+ *
+ * - static: every core takes one chunk of about items/cores, rounded up to a grain (a whole vector
+ *   or a whole word of packed spikes), so a layer smaller than the cores keeps one grain per core;
+ * - dynamic: the layer is cut in chunks of a grain and every core takes the next free chunk from a
+ *   counter shared by the team, until none is left. A core that finishes early takes the work that
+ *   a static partition would have left to a slower core, for layers whose neurons cost differently;
+ * - split: a layer with fewer neurons than cores would leave most of the cores idle, so the inputs are
+ *   distributed instead. Every core accumulates the synaptic current of every neuron over its slice of
+ *   the inputs, in its own row of partial sums, and after a barrier the partial sums of a neuron are
+ *   added up by the core of the neuron, which then updates it. The sums are integers, so the result
+ *   doesn't depend on the order of the reduction.
+ */
+
+#ifndef PARTITION_H
+#define PARTITION_H
+
+// If 1, the synaptic accumulation of the layers too narrow for the cores is split among the cores
+#ifndef SPLIT_REDUCTION
+#define SPLIT_REDUCTION 1
+#endif
+
+// Widest layer whose synaptic accumulation can be split, the size of a row of partial sums
+#ifndef SPLIT_MAX_NEURONS
+#define SPLIT_MAX_NEURONS 64
+#endif
+
+// Upper bound on the number of cores of the team
+#ifdef PMSIS_HOST_MAX_CORES
+#define partitionMaxCores PMSIS_HOST_MAX_CORES
+#else
+#define partitionMaxCores 8
+#endif
+
+typedef struct {
+    int begin;      // First item
+    int end;        // Item after the last, begin == end for an empty range
+} Range;
+
+/**
+ * @brief Size of the chunk of every core in the static partition.
+ *
+ * @param items Number of items to distribute
+ * @param cores Number of cores
+ * @param grain The chunk is a multiple of the grain
+ */
+static inline int partitionChunk(int items, int cores, int grain)
+{
+    return ((items + cores - 1) / cores + grain - 1) / grain * grain;
+}
+
+/**
+ * @brief Range of a core in the static partition.
+ *
+ * @param items Number of items to distribute
+ * @param core The core
+ * @param cores Number of cores
+ * @param grain The chunk is a multiple of the grain
+ */
+static inline Range partitionStatic(int items, int core, int cores, int grain)
+{
+    int chunk = partitionChunk(items, cores, grain);
+    Range range;
+    range.begin = core * chunk < items ? core * chunk : items;
+    range.end = range.begin + chunk < items ? range.begin + chunk : items;
+    return range;
+}
+
+/**
+ * @brief Range of the calling core in the static partition over the cores of the cluster.
+ */
+#define partitionCore(items, grain) partitionStatic((items), pi_core_id(), pi_cl_cluster_nb_cores(), (grain))
+
+/**
+ * @brief Choice of the split accumulation for a layer.
+ *
+ * The accumulation is split when the static partition keeps at most half of the cores busy, and every
+ * core gets at least one input.
+ *
+ * @param items Number of neurons of the layer
+ * @param inputs Number of inputs of the neurons, or of words of bit-packed inputs
+ * @param cores Number of cores
+ * @param grain Granularity of the static partition
+ * @return 1 if the accumulation of the layer is split among the cores
+ */
+static inline int partitionSplit(int items, int inputs, int cores, int grain)
+{
+    int chunk = partitionChunk(items, cores, grain);
+    int busy = (items + chunk - 1) / chunk;
+    return SPLIT_REDUCTION && cores > 1 && items <= SPLIT_MAX_NEURONS && 2 * busy <= cores && inputs >= cores;
+}
+
+/**
+ * @brief Next chunk of the dynamic partition.
+ *
+ * The shared counter is the first item not yet taken; it must be reset to 0, followed by a barrier,
+ * before the team starts taking chunks. The counter is updated in the critical section of the
+ * cluster, which the GAP8 cores, without atomic instructions, implement with the hardware mutex.
+ *
+ * @param next Counter shared by the team
+ * @param items Number of items to distribute
+ * @param grain Size of a chunk
+ * @param range The chunk taken
+ * @return 1 if a chunk was taken, 0 when all the items are taken
+ */
+static inline int partitionNext(volatile int* next, int items, int grain, Range* range)
+{
+    pi_cl_team_critical_enter();
+    range->begin = *next;
+    *next = range->begin + grain;
+    pi_cl_team_critical_exit();
+    if (range->begin >= items) {
+        return 0;
+    }
+    range->end = range->begin + grain < items ? range->begin + grain : items;
+    return 1;
+}
+
+#endif // PARTITION_H
@@ -0,0 +1,106 @@
+/**
+ * @file snnBench.h
+ * @brief Throughput report of the SNN engines, for the benchmark harness of bench/.
+ *
+ * With SNN_BENCH = 1 an engine measures the wall time of its simulation loop (after the instanziation)
+ * and counts the spikes delivered by every source of spikes (the primary inputs and every layer), and
+ * at the end it prints a single line
+ *
+ *     bench engine=lif timesteps=T ns=N neuron_updates=U synaptic_events=S
+ *
+ * where the synaptic events are the spikes received by the neurons, the spikes of a source times the
+ * neurons of the layer that it feeds. The spikes are counted by every core on its own block, so the
+ * counting doesn't need synchronization.
+ *
+ * With SNN_BENCH = 0 (the default) every macro compiles to nothing.
+ */
+
+#ifndef SNN_BENCH_H
+#define SNN_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef SNN_BENCH
+#define SNN_BENCH 0
+#endif
+
+// Number of sources of spikes with their own counter: the primary inputs, then the output of every layer
+#ifndef BENCH_MAX_SOURCES
+#define BENCH_MAX_SOURCES 65
+#endif
+
+// Number of cores with their own counters
+#ifndef BENCH_CORES
+#ifdef PMSIS_HOST_MAX_CORES
+#define BENCH_CORES PMSIS_HOST_MAX_CORES
+#else
+#define BENCH_CORES 8
+#endif
+#endif
+
+#if SNN_BENCH
+
+#if !defined(__riscv) && !defined(__pulp__)
+#include <time.h>
+#endif
+
+static uint64_t benchSpikes[BENCH_CORES][BENCH_MAX_SOURCES];
+
+/**
+ * @brief Wall time in ns.
+ */
+static inline uint64_t benchClock(void)
+{
+#if defined(__riscv) || defined(__pulp__)
+    return (uint64_t)pi_time_get_us() * 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Spikes emitted by a source on the calling core.
+ *
+ * @param core The calling core
+ * @param source 0 for the primary inputs, l+1 for the layer l
+ * @param spikes Number of spikes
+ */
+static inline void benchSpikesAdd(int core, int source, int spikes)
+{
+    benchSpikes[core % BENCH_CORES][source < BENCH_MAX_SOURCES ? source : BENCH_MAX_SOURCES - 1] += spikes;
+}
+
+/**
+ * @brief Spikes emitted by a source on all the cores.
+ */
+static inline uint64_t benchSpikesOf(int source)
+{
+    uint64_t spikes = 0;
+    for (int c = 0; c < BENCH_CORES; c++) {
+        spikes += benchSpikes[c][source < BENCH_MAX_SOURCES ? source : BENCH_MAX_SOURCES - 1];
+    }
+    return spikes;
+}
+
+/**
+ * @brief Report line of the run, parsed by bench/bench.sh.
+ */
+static inline void benchReport(const char* engine, int timesteps, uint64_t ns, uint64_t neuronUpdates, uint64_t synapticEvents)
+{
+    printf("bench engine=%s timesteps=%d ns=%llu neuron_updates=%llu synaptic_events=%llu\n", engine, timesteps,
+           (unsigned long long)ns, (unsigned long long)neuronUpdates, (unsigned long long)synapticEvents);
+}
+
+#else
+
+#define benchClock() ((uint64_t)0)
+#define benchSpikesAdd(core, source, spikes) ((void)0)
+#define benchSpikesOf(source) ((uint64_t)0)
+#define benchReport(engine, timesteps, ns, neuronUpdates, synapticEvents) ((void)0)
+
+#endif
+
+#endif // SNN_BENCH_H
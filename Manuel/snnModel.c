@@ -0,0 +1,296 @@
+/**
+ * @file snnModel.c
+ * @brief Loader of the binary model files described in snnModel.h.
+ */
+
+#include "pmsis.h"
+#include <stdio.h>
+#include <string.h>
+#include "snnModel.h"
+
+#if SNN_MODEL_FLASH
+#include "bsp/fs.h"
+#include "bsp/fs/readfs.h"
+#include "bsp/flash/hyperflash.h"
+
+/** @brief Flash and filesystem of the board, opened by modelOpen. */
+static struct pi_device modelFlash;
+static struct pi_device modelFs;
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+int modelArenaInit(ModelArena* arena, size_t size)
+{
+    //pi_l2_malloc only guarantees a word alignment, so the base is aligned by hand
+    uint8_t* chunk = (uint8_t*)pi_l2_malloc(size + MODEL_ARENA_ALIGN);
+    if (chunk == NULL) {
+        return -1;
+    }
+    arena->base = (uint8_t*)(((uintptr_t)chunk + MODEL_ARENA_ALIGN - 1) / MODEL_ARENA_ALIGN * MODEL_ARENA_ALIGN);
+    arena->size = size;
+    arena->used = 0;
+    arena->chunk = chunk;
+    return 0;
+}
+
+
+void modelArenaFree(ModelArena* arena)
+{
+    if (arena->chunk != NULL) {
+        pi_l2_free(arena->chunk, arena->size + MODEL_ARENA_ALIGN);
+        arena->chunk = NULL;
+    }
+}
+
+
+/**
+* @brief Reading of size bytes of the model file at offset.
+*
+* On host the bytes are copied from the mapping, on target they are read from flash.
+*
+* @return 0 on success, -1 on error
+*/
+
+static int modelRead(SnnModel* model, size_t offset, void* buffer, size_t size)
+{
+    if (offset > model->size || size > model->size - offset) {
+        return -1;
+    }
+#if SNN_MODEL_FLASH
+    pi_fs_seek((pi_fs_file_t*)model->file, offset);
+    return pi_fs_read((pi_fs_file_t*)model->file, buffer, size) == (int)size ? 0 : -1;
+#else
+    memcpy(buffer, model->mapping + offset, size);
+    return 0;
+#endif
+}
+
+
+/**
+* @brief Validation of the header and of the layers of the model.
+*/
+
+static int modelValidate(SnnModel* model)
+{
+    const SnnModelHeader* header = &model->header;
+    if (header->magic != SNN_MODEL_MAGIC) {
+        printf("Model: not a model file\n");
+        return -1;
+    }
+    if (header->version != SNN_MODEL_VERSION) {
+        printf("Model: version %d, expected %d\n", header->version, SNN_MODEL_VERSION);
+        return -1;
+    }
+    if (header->layerCount == 0 || header->weightType > SNN_WEIGHT_INT4) {
+        printf("Model: unsupported layers or weights\n");
+        return -1;
+    }
+    for (int l = 0; l < header->layerCount; l++) {
+        const SnnModelLayer* layer = &model->layers[l];
+        uint64_t bytes = (uint64_t)layer->neuronNumber * modelRowBytes(header->weightType, layer->num_inputs);
+        uint64_t scaleBytes = (uint64_t)layer->neuronNumber * sizeof(int32_t);
+        int quantized = header->weightType != SNN_WEIGHT_INT32;
+        if (layer->neuronNumber == 0 || layer->num_inputs == 0
+            || (l > 0 && layer->num_inputs != model->layers[l - 1].neuronNumber)
+            || layer->weightOffset % sizeof(int32_t) != 0
+            || layer->weightOffset > model->size || bytes > model->size - layer->weightOffset
+            || (quantized && (layer->scaleOffset % sizeof(int32_t) != 0
+                              || layer->scaleOffset > model->size || scaleBytes > model->size - layer->scaleOffset))) {
+            printf("Model: layer %d is not valid\n", l);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+int modelOpen(SnnModel* model, const char* path)
+{
+    memset(model, 0, sizeof(*model));
+#if SNN_MODEL_FLASH
+    struct pi_hyperflash_conf flashConf;
+    struct pi_readfs_conf fsConf;
+    pi_hyperflash_conf_init(&flashConf);
+    pi_open_from_conf(&modelFlash, &flashConf);
+    if (pi_flash_open(&modelFlash)) {
+        printf("Model: flash open failed\n");
+        return -1;
+    }
+    pi_readfs_conf_init(&fsConf);
+    fsConf.fs.flash = &modelFlash;
+    pi_open_from_conf(&modelFs, &fsConf);
+    if (pi_fs_mount(&modelFs)) {
+        printf("Model: filesystem mount failed\n");
+        pi_flash_close(&modelFlash);
+        return -1;
+    }
+    pi_fs_file_t* file = pi_fs_open(&modelFs, path, 0);
+    if (file == NULL) {
+        printf("Model: cannot open %s\n", path);
+        pi_fs_unmount(&modelFs);
+        pi_flash_close(&modelFlash);
+        return -1;
+    }
+    model->file = file;
+    model->size = file->size;
+#else
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Model: cannot open %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    model->size = st.st_size;
+    void* mapping = model->size ? mmap(NULL, model->size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        printf("Model: cannot map %s\n", path);
+        return -1;
+    }
+    model->mapping = mapping;
+#endif
+    size_t bytes = 0;
+    if (modelRead(model, 0, &model->header, sizeof(SnnModelHeader)) == 0) {
+        bytes = (size_t)model->header.layerCount * sizeof(SnnModelLayer);
+        model->layers = (SnnModelLayer*)pi_l2_malloc(bytes ? bytes : 1);
+    }
+    if (model->layers != NULL && modelRead(model, sizeof(SnnModelHeader), model->layers, bytes) == 0) {
+        if (modelValidate(model) == 0) {
+            return 0;
+        }
+    } else {
+        printf("Model: %s is truncated\n", path);
+    }
+    modelClose(model);
+#if !SNN_MODEL_FLASH
+    munmap((void*)model->mapping, model->size);
+#endif
+    return -1;
+}
+
+
+/**
+* @brief Bytes of size at offset in the model file.
+*
+* On host they are the mapped file itself, on target they are read from flash into the arena.
+*
+* @return The bytes, or NULL on error
+*/
+
+static const void* modelBytes(SnnModel* model, size_t offset, size_t size, ModelArena* arena)
+{
+#if SNN_MODEL_FLASH
+    void* bytes = modelArenaAlloc(arena, size);
+    if (bytes == NULL || modelRead(model, offset, bytes, size) != 0) {
+        return NULL;
+    }
+    return bytes;
+#else
+    (void)size;
+    (void)arena;
+    return model->mapping + offset;
+#endif
+}
+
+
+size_t modelLayerWeightsBytes(const SnnModel* model, int layer)
+{
+#if SNN_MODEL_FLASH
+    return modelArenaBytes((size_t)model->layers[layer].neuronNumber
+                           * modelRowBytes(model->header.weightType, model->layers[layer].num_inputs));
+#else
+    (void)model;
+    (void)layer;
+    return 0;
+#endif
+}
+
+
+const void* modelLayerWeights(SnnModel* model, int layer, ModelArena* arena)
+{
+    const SnnModelLayer* record = &model->layers[layer];
+    return modelBytes(model, record->weightOffset,
+                      (size_t)record->neuronNumber * modelRowBytes(model->header.weightType, record->num_inputs), arena);
+}
+
+
+size_t modelLayerScalesBytes(const SnnModel* model, int layer)
+{
+#if SNN_MODEL_FLASH
+    return model->header.weightType == SNN_WEIGHT_INT32 ? 0
+           : modelArenaBytes((size_t)model->layers[layer].neuronNumber * sizeof(int32_t));
+#else
+    (void)model;
+    (void)layer;
+    return 0;
+#endif
+}
+
+
+const int32_t* modelLayerScales(SnnModel* model, int layer, ModelArena* arena)
+{
+    const SnnModelLayer* record = &model->layers[layer];
+    if (model->header.weightType == SNN_WEIGHT_INT32) {
+        return NULL;
+    }
+    return (const int32_t*)modelBytes(model, record->scaleOffset, (size_t)record->neuronNumber * sizeof(int32_t), arena);
+}
+
+
+size_t modelLayerWeights32Bytes(const SnnModel* model, int layer)
+{
+    if (model->header.weightType == SNN_WEIGHT_INT32) {
+        return modelLayerWeightsBytes(model, layer);
+    }
+    //The expanded weights, and the stored ones with their scales on target
+    return modelArenaBytes((size_t)model->layers[layer].neuronNumber * model->layers[layer].num_inputs * sizeof(int32_t))
+           + modelLayerWeightsBytes(model, layer) + modelLayerScalesBytes(model, layer);
+}
+
+
+const int32_t* modelLayerWeights32(SnnModel* model, int layer, ModelArena* arena)
+{
+    const SnnModelLayer* record = &model->layers[layer];
+    uint32_t type = model->header.weightType;
+    if (type == SNN_WEIGHT_INT32) {
+        return (const int32_t*)modelLayerWeights(model, layer, arena);
+    }
+    int32_t* weights = (int32_t*)modelArenaAlloc(arena, (size_t)record->neuronNumber * record->num_inputs * sizeof(int32_t));
+    const uint8_t* rows = (const uint8_t*)modelLayerWeights(model, layer, arena);
+    const int32_t* scales = modelLayerScales(model, layer, arena);
+    if (weights == NULL || rows == NULL || scales == NULL) {
+        return NULL;
+    }
+    size_t rowBytes = modelRowBytes(type, record->num_inputs);
+    for (uint32_t n = 0; n < record->neuronNumber; n++) {
+        for (uint32_t i = 0; i < record->num_inputs; i++) {
+            weights[(size_t)n * record->num_inputs + i] = modelWeight(type, rows + n * rowBytes, i) * scales[n];
+        }
+    }
+    return weights;
+}
+
+
+void modelClose(SnnModel* model)
+{
+    if (model->layers != NULL) {
+        pi_l2_free(model->layers, (size_t)model->header.layerCount * sizeof(SnnModelLayer));
+        model->layers = NULL;
+    }
+#if SNN_MODEL_FLASH
+    if (model->file != NULL) {
+        pi_fs_close((pi_fs_file_t*)model->file);
+        pi_fs_unmount(&modelFs);
+        pi_flash_close(&modelFlash);
+        model->file = NULL;
+    }
+#endif
+}
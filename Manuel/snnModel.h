@@ -0,0 +1,241 @@
+/**
+ * @file snnModel.h
+ * @brief Versioned binary model file of a trained network, and the arena its layers are allocated from.
+ *
+ * A model file is made of:
+ * - a SnnModelHeader;
+ * - layerCount SnnModelLayer records, from the input to the output;
+ * - the weights of every layer, row-major (one row of num_inputs weights for every neuron),
+ *   at the weightOffset of the layer, a multiple of 4 bytes.
+ *
+ * The weights are int32, or quantized (weightType of the header). Quantized weights are int8, or int4
+ * two in a byte (the weight j is the low nibble of the byte j/2 if j is even, the high one otherwise),
+ * and every row is padded with zeros to a multiple of SNN_WEIGHT_ROW_ALIGN weights, so the rows start
+ * on a word. The weight is q * scale, with one int32 scale for every neuron at the scaleOffset of the layer,
+ * a multiple of 4 bytes. This is the layout of the LIF engine with WEIGHT_BITS 8 or 4, so the weights of
+ * a model that match the engine are used as they are.
+ * Every field is little-endian, like both GAP8 and x86 hosts, so the weights can be used in place.
+ *
+ * On host the file is mapped with mmap and the weights are never copied; on GAP8 the file is read
+ * from the flash filesystem and the weights are copied in L2.
+ *
+ *     gcc -O2 -IManuel Manuel/host/modelExport.c -o modelExport && ./modelExport model.snn 10 10 8 3
+ */
+
+#ifndef SNN_MODEL_H
+#define SNN_MODEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// "SNNM", the first 4 bytes of a model file
+#define SNN_MODEL_MAGIC 0x4d4e4e53u
+
+// Version of the format, incremented at every incompatible change
+#define SNN_MODEL_VERSION 1
+
+// Neuron models
+#define SNN_MODEL_LIF 0
+#define SNN_MODEL_IZHIKEVICH 1
+
+// Types of the weights
+#define SNN_WEIGHT_INT32 0
+#define SNN_WEIGHT_INT8 1
+#define SNN_WEIGHT_INT4 2
+
+// Quantized rows are padded to a multiple of this number of weights
+#define SNN_WEIGHT_ROW_ALIGN 8
+
+// Parameters of the neurons are stored in Q16.16, independently of the format used by the engine
+#define SNN_PARAM_FROM_DOUBLE(x) ((int32_t)((x) >= 0 ? (x) * 65536.0 + 0.5 : (x) * 65536.0 - 0.5))
+#define SNN_PARAM_TO_DOUBLE(x) ((double)(x) / 65536.0)
+
+// If 1, the model is read from the flash of the board, otherwise it is mapped from a host file
+#ifndef SNN_MODEL_FLASH
+#if defined(__riscv) || defined(__pulp__)
+#define SNN_MODEL_FLASH 1
+#else
+#define SNN_MODEL_FLASH 0
+#endif
+#endif
+
+typedef struct {
+    uint32_t magic;         // SNN_MODEL_MAGIC
+    uint16_t version;       // SNN_MODEL_VERSION
+    uint16_t layerCount;    // Number of layers
+    uint32_t neuronModel;   // SNN_MODEL_LIF or SNN_MODEL_IZHIKEVICH
+    uint32_t weightType;    // SNN_WEIGHT_INT32, SNN_WEIGHT_INT8 or SNN_WEIGHT_INT4
+} SnnModelHeader;
+
+typedef struct {
+    uint32_t neuronNumber;  // Number of neurons of the layer
+    uint32_t num_inputs;    // Number of inputs of every neuron
+    int32_t params[4];      // Q16.16 parameters, LIF: threshold, reset, tau; Izhikevich: a, b, c, d
+    uint32_t weightOffset;  // Position of the weights in the file, in bytes
+    uint32_t scaleOffset;   // Position of the scales of the neurons in the file, 0 with int32 weights
+} SnnModelLayer;
+
+// Parameters of a LIF layer
+#define SNN_LIF_THRESHOLD 0
+#define SNN_LIF_RESET 1
+#define SNN_LIF_TAU 2
+
+typedef struct {
+    SnnModelHeader header;
+    SnnModelLayer* layers;      // Layer records, allocated by modelOpen
+    const uint8_t* mapping;     // Whole file mapped in memory (host only)
+    size_t size;                // Size of the file in bytes
+    void* file;                 // Open file of the flash filesystem (target only)
+} SnnModel;
+
+/**
+ * @brief Bits of a weight of the given type.
+ */
+static inline int modelWeightBits(uint32_t weightType)
+{
+    return weightType == SNN_WEIGHT_INT8 ? 8 : (weightType == SNN_WEIGHT_INT4 ? 4 : 32);
+}
+
+/**
+ * @brief Weights of a row of the given type, with the padding.
+ */
+static inline size_t modelRowWeights(uint32_t weightType, uint32_t inputs)
+{
+    return weightType == SNN_WEIGHT_INT32 ? inputs
+         : ((size_t)inputs + SNN_WEIGHT_ROW_ALIGN - 1) / SNN_WEIGHT_ROW_ALIGN * SNN_WEIGHT_ROW_ALIGN;
+}
+
+/**
+ * @brief Bytes of a row of the given type.
+ */
+static inline size_t modelRowBytes(uint32_t weightType, uint32_t inputs)
+{
+    return modelRowWeights(weightType, inputs) * modelWeightBits(weightType) / 8;
+}
+
+/**
+ * @brief Stored value of the weight j of a row of the given type, without the scale.
+ */
+static inline int32_t modelWeight(uint32_t weightType, const void* row, size_t j)
+{
+    if (weightType == SNN_WEIGHT_INT8) {
+        return ((const int8_t*)row)[j];
+    }
+    if (weightType == SNN_WEIGHT_INT4) {
+        return (int32_t)(int8_t)(uint8_t)(((const uint8_t*)row)[j >> 1] << ((j & 1) ? 0 : 4)) >> 4;
+    }
+    return ((const int32_t*)row)[j];
+}
+
+/* Linear allocator: all the memory of a loaded network comes from one block, so loading a model
+costs a single allocation and the layers are contiguous. */
+typedef struct {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    void* chunk;    // Block given by pi_l2_malloc, base is aligned inside it
+} ModelArena;
+
+// Alignment of every allocation of the arena, enough for the widest vector of the engines
+#ifndef MODEL_ARENA_ALIGN
+#define MODEL_ARENA_ALIGN 32
+#endif
+
+// Space taken in the arena by an allocation of the given size
+#define modelArenaBytes(bytes) (((size_t)(bytes) + MODEL_ARENA_ALIGN - 1) / MODEL_ARENA_ALIGN * MODEL_ARENA_ALIGN)
+
+/**
+ * @brief Allocation of size bytes from the arena, aligned to MODEL_ARENA_ALIGN.
+ *
+ * @return The allocated memory, or NULL if the arena is full
+ */
+static inline void* modelArenaAlloc(ModelArena* arena, size_t size)
+{
+    size_t bytes = modelArenaBytes(size);
+    if (arena->used + bytes > arena->size) {
+        return NULL;
+    }
+    void* chunk = arena->base + arena->used;
+    arena->used += bytes;
+    return chunk;
+}
+
+/**
+ * @brief Allocation of the arena, in L2 on target.
+ *
+ * @param arena The arena to initialize
+ * @param size Total size of the allocations that will be done, computed with modelArenaBytes
+ * @return 0 on success, -1 if the memory is not available
+ */
+int modelArenaInit(ModelArena* arena, size_t size);
+
+/**
+ * @brief Release of an arena that is no longer used, such as a scratch arena of the loading.
+ */
+void modelArenaFree(ModelArena* arena);
+
+/**
+ * @brief Opening of a model file and validation of its header and layers.
+ *
+ * Every layer must take the previous one as input, and its weights must be inside the file.
+ *
+ * @param model The model to open
+ * @param path Path of the file, on host, or name of the file in the flash filesystem, on target
+ * @return 0 on success, -1 if the file cannot be read or is not a valid model of this version
+ */
+int modelOpen(SnnModel* model, const char* path);
+
+/**
+ * @brief Weights of a layer, row-major, as they are stored (weightType of the header).
+ *
+ * On host they are the mapped file itself, on target they are read from flash into the arena.
+ *
+ * @param model The opened model
+ * @param layer Number of the layer
+ * @param arena Arena of the network, used only on target
+ * @return The weights, or NULL on error
+ */
+const void* modelLayerWeights(SnnModel* model, int layer, ModelArena* arena);
+
+/**
+ * @brief Space of the arena needed by modelLayerWeights for a layer: 0 on host.
+ */
+size_t modelLayerWeightsBytes(const SnnModel* model, int layer);
+
+/**
+ * @brief Scales of the neurons of a layer with quantized weights, like modelLayerWeights.
+ *
+ * @return The scales, or NULL on error or with int32 weights
+ */
+const int32_t* modelLayerScales(SnnModel* model, int layer, ModelArena* arena);
+
+/**
+ * @brief Space of the arena needed by modelLayerScales for a layer: 0 on host.
+ */
+size_t modelLayerScalesBytes(const SnnModel* model, int layer);
+
+/**
+ * @brief Weights of a layer as int32 rows of num_inputs weights, the scale applied.
+ *
+ * With int32 weights they are the ones of modelLayerWeights, quantized ones are expanded in the arena.
+ *
+ * @param model The opened model
+ * @param layer Number of the layer
+ * @param arena Arena of the network
+ * @return The weights, or NULL on error
+ */
+const int32_t* modelLayerWeights32(SnnModel* model, int layer, ModelArena* arena);
+
+/**
+ * @brief Space of the arena needed by modelLayerWeights32 for a layer.
+ */
+size_t modelLayerWeights32Bytes(const SnnModel* model, int layer);
+
+/**
+ * @brief Closing of the model, after the network has been built.
+ *
+ * On host the mapping is kept, because the weights are used in place.
+ */
+void modelClose(SnnModel* model);
+
+#endif // SNN_MODEL_H
@@ -0,0 +1,195 @@
+/**
+ * @file snnPerf.c
+ * @brief Performance counters of the SNN engines, see snnPerf.h.
+ */
+
+#include "pmsis.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "snnPerf.h"
+
+#if SNN_PERF
+
+/** @brief Counters of every core in every phase. */
+static PerfCounters perfTable[SNN_PERF_CORES][perfPhases];
+
+/** @brief Names of the phases in the report. */
+static const char* perfPhaseName[PERF_LAYER] = {"init", "output reset", "input", "barrier wait"};
+
+#if defined(__riscv) || defined(__pulp__)
+
+/**
+* @brief Reading of the PULP counters of the core.
+*
+* The counters are started the first time, and never reset, so a phase is the difference of two
+* readings; the 32 bit counters wrap, so the difference is computed on 32 bit.
+*/
+
+static void perfRead(PerfSample* sample)
+{
+    static uint8_t started[SNN_PERF_CORES];
+    int core = pi_core_id();
+    if (!started[core]) {
+        pi_perf_conf((1 << PI_PERF_CYCLES) | (1 << PI_PERF_INSTR) | (1 << PI_PERF_LD_STALL) | (1 << PI_PERF_TCDM_CONT));
+        pi_perf_reset();
+        pi_perf_start();
+        started[core] = 1;
+    }
+    sample->cycles = pi_perf_read(PI_PERF_CYCLES);
+    sample->instructions = pi_perf_read(PI_PERF_INSTR);
+    sample->stalls = pi_perf_read(PI_PERF_LD_STALL);
+    sample->tcdmContention = pi_perf_read(PI_PERF_TCDM_CONT);
+}
+
+#define perfDelta(now, then) ((uint32_t)((now) - (then)))
+#define perfStallsName "load stalls"
+
+#else
+
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* The perf_event counters of a thread are opened the first time the thread reads them,
+and closed when the thread exits. */
+typedef struct {
+    int instructions;
+    int stalls;
+} PerfEvents;
+
+static pthread_key_t perfKey;
+static pthread_once_t perfOnce = PTHREAD_ONCE_INIT;
+
+static void perfCloseEvents(void* arg)
+{
+    PerfEvents* events = (PerfEvents*)arg;
+    if (events->instructions >= 0) {
+        close(events->instructions);
+    }
+    if (events->stalls >= 0) {
+        close(events->stalls);
+    }
+    free(events);
+}
+
+static void perfCreateKey(void)
+{
+    pthread_key_create(&perfKey, perfCloseEvents);
+}
+
+static int perfOpen(uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t perfReadEvent(int fd)
+{
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return 0;
+    }
+    return value;
+}
+
+static void perfRead(PerfSample* sample)
+{
+    pthread_once(&perfOnce, perfCreateKey);
+    PerfEvents* events = (PerfEvents*)pthread_getspecific(perfKey);
+    if (events == NULL) {
+        events = (PerfEvents*)malloc(sizeof(PerfEvents));
+        events->instructions = perfOpen(PERF_COUNT_HW_INSTRUCTIONS);
+        events->stalls = perfOpen(PERF_COUNT_HW_STALLED_CYCLES_BACKEND);
+        pthread_setspecific(perfKey, events);
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    sample->cycles = __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->cycles = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+#endif
+    sample->instructions = perfReadEvent(events->instructions);
+    sample->stalls = perfReadEvent(events->stalls);
+    sample->tcdmContention = 0;
+}
+
+#define perfDelta(now, then) ((now) - (then))
+#define perfStallsName "backend stalls"
+
+#endif
+
+
+void perfBegin(PerfSample* sample)
+{
+    perfRead(sample);
+}
+
+
+void perfEnd(int phase, const PerfSample* sample)
+{
+    PerfSample now;
+    perfRead(&now);
+    PerfCounters* counters = &perfTable[pi_core_id() % SNN_PERF_CORES][phase];
+    counters->total.cycles += perfDelta(now.cycles, sample->cycles);
+    counters->total.instructions += perfDelta(now.instructions, sample->instructions);
+    counters->total.stalls += perfDelta(now.stalls, sample->stalls);
+    counters->total.tcdmContention += perfDelta(now.tcdmContention, sample->tcdmContention);
+    counters->count++;
+}
+
+
+/**
+* @brief Report of the counters.
+*
+* For every phase, one line per core with the counters per timestep (the instanziation is reported
+as a whole), then the imbalance of the phase, the slowest core over the average of the cores.
+*/
+
+void perfReport(int timesteps)
+{
+    printf("\nPerformance counters per timestep (%d timesteps)\n", timesteps);
+    printf("%-14s %4s %14s %14s %14s %12s\n", "phase", "core", "cycles", "instructions", perfStallsName, "tcdm cont.");
+    for (int phase = 0; phase < perfPhases; phase++) {
+        uint64_t slowest = 0, sum = 0;
+        int cores = 0;
+        uint64_t divisor = phase == PERF_INIT || timesteps <= 0 ? 1 : timesteps;
+        char name[32];
+        if (phase < PERF_LAYER) {
+            snprintf(name, sizeof(name), "%s", perfPhaseName[phase]);
+        } else {
+            snprintf(name, sizeof(name), "layer %d", phase - PERF_LAYER + 1);
+        }
+        for (int core = 0; core < SNN_PERF_CORES; core++) {
+            PerfCounters* counters = &perfTable[core][phase];
+            if (counters->count == 0) {
+                continue;
+            }
+            printf("%-14s %4d %14llu %14llu %14llu %12llu\n", name, core,
+                   (unsigned long long)(counters->total.cycles / divisor),
+                   (unsigned long long)(counters->total.instructions / divisor),
+                   (unsigned long long)(counters->total.stalls / divisor),
+                   (unsigned long long)(counters->total.tcdmContention / divisor));
+            slowest = counters->total.cycles > slowest ? counters->total.cycles : slowest;
+            sum += counters->total.cycles;
+            cores++;
+        }
+        if (cores > 1 && sum > 0) {
+            printf("%-14s imbalance %.2f\n", name, (double)slowest * cores / sum);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file snnPerf.h
+ * @brief Per-core and per-phase performance counters of the SNN engines.
+ *
+ * Every cluster core accumulates, for every phase of the simulation (instanziation, output reset,
+ * input load, compute of every layer, barrier wait), the cycles, the instructions, the stalls
+ * and the TCDM contention it spent there. perfReport prints the counters per timestep and per core,
+ * so the load imbalance between the cores is visible.
+ *
+ * On GAP8 the counters are the PULP performance counters (pi_perf_*); depending on the chip only
+ * some events are counted together with the cycles, the others read as 0.
+ * On host the cycles are the TSC (or the monotonic clock in ns), the instructions and the backend
+ * stalls come from perf_event when the kernel allows it, and there is no TCDM. The backend stalls
+ * count every stall of the execution units, not only the loads, so the report names them apart.
+ *
+ * With SNN_PERF = 0 (the default) every macro compiles to nothing.
+ */
+
+#ifndef SNN_PERF_H
+#define SNN_PERF_H
+
+#include <stdint.h>
+
+#ifndef SNN_PERF
+#define SNN_PERF 0
+#endif
+
+// Phases of the simulation, the compute of the layer l is the phase PERF_LAYER + l
+#define PERF_INIT 0
+#define PERF_OUTPUT 1
+#define PERF_INPUT 2
+#define PERF_BARRIER 3
+#define PERF_LAYER 4
+
+// Number of layers with their own counters, the deeper ones share the last
+#ifndef PERF_MAX_LAYERS
+#define PERF_MAX_LAYERS 16
+#endif
+
+#define perfPhases (PERF_LAYER + PERF_MAX_LAYERS)
+
+// Number of cores with their own counters
+#ifndef SNN_PERF_CORES
+#ifdef PMSIS_HOST_MAX_CORES
+#define SNN_PERF_CORES PMSIS_HOST_MAX_CORES
+#else
+#define SNN_PERF_CORES 8
+#endif
+#endif
+
+// Counters read at the beginning of a phase
+typedef struct {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t stalls;        // Load stalls on GAP8, backend stalls on host
+    uint64_t tcdmContention;
+} PerfSample;
+
+// Counters accumulated by a core in a phase
+typedef struct {
+    PerfSample total;
+    uint32_t count;     // Number of times the phase was executed
+} PerfCounters;
+
+#if SNN_PERF
+
+/**
+ * @brief Beginning of a phase on the calling core, the counters are started if needed.
+ */
+void perfBegin(PerfSample* sample);
+
+/**
+ * @brief End of a phase on the calling core, the counters since perfBegin are added to the phase.
+ */
+void perfEnd(int phase, const PerfSample* sample);
+
+/**
+ * @brief Report of the counters, divided by the number of timesteps for the simulation phases.
+ */
+void perfReport(int timesteps);
+
+#define perfLayer(l) (PERF_LAYER + ((l) < PERF_MAX_LAYERS ? (l) : PERF_MAX_LAYERS - 1))
+
+#else
+
+#define perfBegin(sample) ((void)(sample))
+#define perfEnd(phase, sample) ((void)(sample))
+#define perfReport(timesteps) ((void)0)
+#define perfLayer(l) 0
+
+#endif
+
+#endif // SNN_PERF_H
@@ -0,0 +1,182 @@
+/**
+ * @file snnTrace.h
+ * @brief Leveled tracing of the SNN engines, compiled out when disabled.
+ *
+ * SNN_TRACE_LEVEL selects what is traced:
+ * - TRACE_OFF: nothing, every trace macro compiles to nothing;
+ * - TRACE_SUMMARY: the phases of the run and the timesteps;
+ * - TRACE_LAYER: also the layers and their outputs;
+ * - TRACE_NEURON: also every neuron update, the hot path of the engines.
+ *
+ * The neuron updates are printed, or with SNN_TRACE_BINARY = 1 they are stored as binary records
+ * (timestep, layer, neuron, potential, spiked) in a ring buffer for every core, with no printf and
+ * no synchronization between the cores, and traceDump writes the buffers after the run.
+ * A ring keeps the last SNN_TRACE_CAPACITY records of its core. The updates of a core without a ring
+ * are not recorded, so an engine with more cores than SNN_TRACE_CORES checks traceFits before the run.
+ *
+ * A printf from the GAP8 cluster goes through the fabric controller, so on target every level above
+ * TRACE_SUMMARY should be used only to debug.
+ */
+
+#ifndef SNN_TRACE_H
+#define SNN_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TRACE_OFF 0
+#define TRACE_SUMMARY 1
+#define TRACE_LAYER 2
+#define TRACE_NEURON 3
+
+#ifndef SNN_TRACE_LEVEL
+#define SNN_TRACE_LEVEL TRACE_SUMMARY
+#endif
+
+// If 1, the neuron updates are stored in the ring buffers instead of being printed
+#ifndef SNN_TRACE_BINARY
+#define SNN_TRACE_BINARY 0
+#endif
+
+// Number of records of the ring buffer of a core
+#ifndef SNN_TRACE_CAPACITY
+#define SNN_TRACE_CAPACITY 1024
+#endif
+
+// Number of ring buffers, one for every core that can trace: all the cores the host emulation allows
+#ifndef SNN_TRACE_CORES
+#ifdef PMSIS_HOST_MAX_CORES
+#define SNN_TRACE_CORES PMSIS_HOST_MAX_CORES
+#else
+#define SNN_TRACE_CORES 8
+#endif
+#endif
+
+// Core that is tracing, redefined by the engines that run on more cores
+#ifndef traceCore
+#define traceCore() 0
+#endif
+
+// Timestep and layer being simulated, for the engines whose neuron update doesn't know them
+typedef struct {
+    int step;
+    int layer;
+} TraceContext;
+
+static TraceContext traceNow __attribute__((unused));
+
+#define traceSetTimestep(t) (traceNow.step = (t))
+#define traceSetLayer(l) (traceNow.layer = (l))
+
+#if SNN_TRACE_LEVEL >= TRACE_SUMMARY
+#define traceSummary(...) printf(__VA_ARGS__)
+#else
+#define traceSummary(...) ((void)0)
+#endif
+
+#if SNN_TRACE_LEVEL >= TRACE_LAYER
+#define traceLayer(...) printf(__VA_ARGS__)
+#else
+#define traceLayer(...) ((void)0)
+#endif
+
+#if SNN_TRACE_LEVEL >= TRACE_NEURON && SNN_TRACE_BINARY
+
+typedef struct {
+    uint32_t step;      // Timestep
+    uint32_t layer;
+    uint32_t neuron;
+    int32_t potential;  // Q16.16
+    int32_t spiked;
+} TraceRecord;
+
+typedef struct {
+    TraceRecord records[SNN_TRACE_CAPACITY];
+    uint32_t written;   // Number of records written since the start, the ring keeps the last ones
+} TraceRing;
+
+static TraceRing traceRings[SNN_TRACE_CORES];
+
+// 1 if every one of the cores has its own ring buffer
+#define traceFits(cores) ((cores) <= SNN_TRACE_CORES)
+
+/**
+ * @brief Record of a neuron update in the ring buffer of the core.
+ *
+ * A core without a ring doesn't record, it would race with the core that owns the ring.
+ */
+static inline void traceRecord(int step, int layer, int neuron, int32_t potential, int spiked)
+{
+    int core = traceCore();
+    if (core >= SNN_TRACE_CORES) {
+        return;
+    }
+    TraceRing* ring = &traceRings[core];
+    TraceRecord* record = &ring->records[ring->written % SNN_TRACE_CAPACITY];
+    record->step = step;
+    record->layer = layer;
+    record->neuron = neuron;
+    record->potential = potential;
+    record->spiked = spiked;
+    ring->written++;
+}
+
+/**
+ * @brief Neuron update, stored as a binary record; the text arguments are not evaluated.
+ *
+ * @param t Timestep, -1 for the instanziation
+ * @param l Layer
+ * @param n Neuron
+ * @param potential Potential in Q16.16
+ * @param spiked Spike flag
+ */
+#define traceNeuron(t, l, n, potential, spiked, ...) traceRecord((t), (l), (n), (potential), (spiked))
+
+/**
+ * @brief Dump of the ring buffers, after the run.
+ *
+ * On host the records of every core are written, oldest first, in the binary file SNN_TRACE_FILE
+ * (or snnTrace.bin), on target they are printed.
+ */
+static inline void traceDump(void)
+{
+#if defined(__riscv) || defined(__pulp__)
+    for (int c = 0; c < SNN_TRACE_CORES; c++) {
+        TraceRing* ring = &traceRings[c];
+        uint32_t first = ring->written > SNN_TRACE_CAPACITY ? ring->written - SNN_TRACE_CAPACITY : 0;
+        for (uint32_t i = first; i < ring->written; i++) {
+            TraceRecord* record = &ring->records[i % SNN_TRACE_CAPACITY];
+            printf("%d %d %d %d %d\n", (int)record->step, record->layer, record->neuron,
+                   (int)record->potential, (int)record->spiked);
+        }
+    }
+#else
+    const char* path = getenv("SNN_TRACE_FILE") ? getenv("SNN_TRACE_FILE") : "snnTrace.bin";
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Trace: cannot create %s\n", path);
+        return;
+    }
+    for (int c = 0; c < SNN_TRACE_CORES; c++) {
+        TraceRing* ring = &traceRings[c];
+        uint32_t first = ring->written > SNN_TRACE_CAPACITY ? ring->written - SNN_TRACE_CAPACITY : 0;
+        for (uint32_t i = first; i < ring->written; i++) {
+            fwrite(&ring->records[i % SNN_TRACE_CAPACITY], sizeof(TraceRecord), 1, file);
+        }
+    }
+    fclose(file);
+#endif
+}
+
+#elif SNN_TRACE_LEVEL >= TRACE_NEURON
+#define traceNeuron(t, l, n, potential, spiked, ...) printf(__VA_ARGS__)
+#define traceDump() ((void)0)
+#define traceFits(cores) 1
+#else
+#define traceNeuron(...) ((void)0)
+#define traceDump() ((void)0)
+#define traceFits(cores) 1
+#endif
+
+#endif // SNN_TRACE_H
@@ -0,0 +1,156 @@
+/**
+ * @file sparseWeights.h
+ * @brief Compressed weights of pruned layers, CSR (a row for every neuron) or CSC (a column for every input).
+ *
+ * Only the weights whose magnitude reaches the pruning threshold are stored, with the index of
+ * their input (CSR) or neuron (CSC), so both the memory and the synaptic work are proportional to
+ * the connections left. The rows are used by the dense-input propagation, that sums the weights of
+ * the spiking inputs of a neuron, the columns by the event-driven one, that adds the column of
+ * every spiking source to the neurons.
+ * The entries of a row or of a column are stored by increasing index.
+ */
+
+#ifndef SPARSE_WEIGHTS_H
+#define SPARSE_WEIGHTS_H
+
+#include <stdint.h>
+#include "spikeVector.h"
+#include "spikeList.h"
+
+typedef struct {
+    int* start;     // Entries of the line k are [start[k],start[k+1]), lines+1 values
+    int* index;     // Input (CSR) or neuron (CSC) of every entry
+    int* value;     // Weight of every entry
+    int lines;      // Number of rows (neurons) or columns (inputs)
+} SparseWeights;
+
+/**
+ * @brief Number of weights of a dense matrix kept by the pruning.
+ *
+ * The weight of the neuron n and of the input i is dense[n * neuronStride + i * inputStride], so
+ * the matrix can be row-major or column-major.
+ *
+ * @param dense The dense weights
+ * @param neurons Number of neurons
+ * @param inputs Number of inputs of every neuron
+ * @param neuronStride Distance between the weights of two consecutive neurons
+ * @param inputStride Distance between the weights of two consecutive inputs
+ * @param threshold The weights with a smaller magnitude are pruned
+ */
+static inline int sparseCount(const int32_t* dense, int neurons, int inputs, int neuronStride, int inputStride, int threshold)
+{
+    int count = 0;
+    for (int n = 0; n < neurons; n++) {
+        for (int i = 0; i < inputs; i++) {
+            int32_t weight = dense[n * neuronStride + i * inputStride];
+            count += (weight >= 0 ? weight : -weight) >= threshold;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Pruning of a dense matrix by magnitude, into CSR or CSC.
+ *
+ * The arrays of the sparse matrix are given by the caller: start of lines+1 ints, index and value
+ * of sparseCount ints.
+ *
+ * @param dense The dense weights, see sparseCount
+ * @param neurons Number of neurons
+ * @param inputs Number of inputs of every neuron
+ * @param neuronStride Distance between the weights of two consecutive neurons
+ * @param inputStride Distance between the weights of two consecutive inputs
+ * @param threshold The weights with a smaller magnitude are pruned
+ * @param byInput If 1 the matrix is stored CSC, a column for every input, otherwise CSR
+ * @param sparse The sparse matrix to fill
+ * @return Number of weights kept
+ */
+static inline int sparsePrune(const int32_t* dense, int neurons, int inputs, int neuronStride, int inputStride,
+                              int threshold, int byInput, SparseWeights* sparse)
+{
+    int lines = byInput ? inputs : neurons;
+    int length = byInput ? neurons : inputs;
+    int count = 0;
+    for (int k = 0; k < lines; k++) {
+        sparse->start[k] = count;
+        for (int j = 0; j < length; j++) {
+            int32_t weight = byInput ? dense[j * neuronStride + k * inputStride] : dense[k * neuronStride + j * inputStride];
+            if ((weight >= 0 ? weight : -weight) >= threshold) {
+                sparse->index[count] = j;
+                sparse->value[count] = weight;
+                count++;
+            }
+        }
+    }
+    sparse->start[lines] = count;
+    sparse->lines = lines;
+    return count;
+}
+
+/**
+ * @brief Sum of the weights of the spiking inputs of a neuron, from its CSR row.
+ *
+ * @param rows The CSR weights of the layer
+ * @param neuron The neuron
+ * @param spikes Spike flags of the inputs, 0 or 1
+ */
+static inline int sparseRowFlags(const SparseWeights* rows, int neuron, const int* spikes)
+{
+    int current = 0;
+    for (int k = rows->start[neuron]; k < rows->start[neuron + 1]; k++) {
+        current += spikes[rows->index[k]] * rows->value[k];
+    }
+    return current;
+}
+
+/**
+ * @brief Sum of the weights of the spiking inputs of a neuron, from its CSR row and bit-packed spikes.
+ *
+ * @param rows The CSR weights of the layer
+ * @param neuron The neuron
+ * @param spikes Bit-packed spikes of the inputs
+ */
+static inline int sparseRowPacked(const SparseWeights* rows, int neuron, const spike_word_t* spikes)
+{
+    int current = 0;
+    for (int k = rows->start[neuron]; k < rows->start[neuron + 1]; k++) {
+        current += spikeTest(spikes, rows->index[k]) * rows->value[k];
+    }
+    return current;
+}
+
+/**
+ * @brief Scatter of the CSC columns of the spiking sources.
+ *
+ * For every spike of the list, the entries of the column of the source that belong to the neurons
+ * [begin,end) are added to their current. The first of them is found by a binary search, because
+ * the entries of a column are sorted by neuron, so every core only reads the entries of its block.
+ *
+ * @param list Spikes of the previous layer
+ * @param columns The CSC weights of the layer
+ * @param current Synaptic current of the neurons of the layer, accumulated
+ * @param begin First neuron
+ * @param end Neuron after the last
+ */
+static inline void sparseScatter(const SpikeList* list, const SparseWeights* columns, int* current, int begin, int end)
+{
+    for (int b = 0; b < list->blocks; b++) {
+        const int* index = list->index + b * list->blockSize;
+        for (int s = 0; s < list->count[b]; s++) {
+            int low = columns->start[index[s]], high = columns->start[index[s] + 1];
+            while (low < high) {
+                int middle = (low + high) / 2;
+                if (columns->index[middle] < begin) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+            for (int k = low; k < columns->start[index[s] + 1] && columns->index[k] < end; k++) {
+                current[columns->index[k]] += columns->value[k];
+            }
+        }
+    }
+}
+
+#endif // SPARSE_WEIGHTS_H
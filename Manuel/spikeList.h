@@ -0,0 +1,73 @@
+/**
+ * @file spikeList.h
+ * @brief Spike lists for the event-driven propagation between layers.
+ *
+ * A layer publishes the indexes of its spiking neurons instead of one flag per neuron, and
+ * the next layer adds the weight column of every spiking source to its neurons, so the
+ * synaptic work is proportional to the number of spikes.
+ * The layer is simulated by blocks of blockSize neurons, one block per core: each block writes
+ * its spikes compacted at the beginning of its own slice of index[], and their number in
+ * count[block], so the cores never write the same location.
+ */
+
+#ifndef SPIKE_LIST_H
+#define SPIKE_LIST_H
+
+typedef struct {
+    int* index;      // Indexes of the spiking neurons, the spikes of block b start at index[b*blockSize]
+    int* count;      // Number of spikes of every block
+    int blockSize;   // Number of neurons of a block
+    int blocks;      // Number of blocks
+} SpikeList;
+
+/**
+ * @brief Compaction of the spike flags of a block into the list.
+ *
+ * The block number is given by the caller, so a core never reads the blockSize that core 0 may
+ * be writing for the same timestep.
+ *
+ * @param list The spike list of the layer
+ * @param block Number of the block, begin = block * list->blockSize
+ * @param flags Spike flags of the layer, 0 or 1
+ * @param begin First neuron of the block
+ * @param end Neuron after the last of the block
+ */
+static inline void spikeListBlock(SpikeList* list, int block, const int* flags, int begin, int end)
+{
+    int* index = list->index + begin;
+    int spikes = 0;
+    for (int i = begin; i < end; i++) {
+        index[spikes] = i;
+        spikes += flags[i];
+    }
+    list->count[block] = spikes;
+}
+
+/**
+ * @brief Scatter of the weight columns of the spiking sources.
+ *
+ * For every spike of the list, the column of weights of the source is added to the current of the
+ * neurons [begin,end). The columns are contiguous (column-major weights), so the inner loop is a
+ * streaming vector addition.
+ *
+ * @param list Spikes of the previous layer
+ * @param columns Column-major weights, column src starts at columns[src*stride]
+ * @param stride Distance between two columns
+ * @param current Synaptic current of the neurons of the layer, accumulated
+ * @param begin First neuron
+ * @param end Neuron after the last
+ */
+static inline void spikeListScatter(const SpikeList* list, const int* columns, int stride, int* current, int begin, int end)
+{
+    for (int b = 0; b < list->blocks; b++) {
+        const int* index = list->index + b * list->blockSize;
+        for (int k = 0; k < list->count[b]; k++) {
+            const int* column = columns + index[k] * stride;
+            for (int i = begin; i < end; i++) {
+                current[i] += column[i];
+            }
+        }
+    }
+}
+
+#endif // SPIKE_LIST_H
@@ -0,0 +1,335 @@
+/**
+ * @file spikeSource.c
+ * @brief Streaming sources of the primary input spikes, see spikeSource.h.
+ */
+
+#include "pmsis.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include "spikeSource.h"
+
+#if SPIKE_FLASH_SOURCE
+#include "bsp/fs.h"
+#include "bsp/fs/readfs.h"
+#include "bsp/flash/hyperflash.h"
+
+/** @brief Flash and filesystem of the spike file, opened by spikeFlashOpen. */
+static struct pi_device spikeFlash;
+static struct pi_device spikeFs;
+#endif
+
+
+/**
+* @brief Frame t of a frames source, in its slot of the ring with a producer.
+*/
+
+static inline const uint8_t* spikeFrameAt(SpikeFramesSource* frames, int t)
+{
+    int slot = frames->refill != NULL ? t % frames->slots : t;
+    return frames->frames + slot * frames->source.frameBytes;
+}
+
+
+/**
+* @brief Refill of the block of the ring that receives the frames from first.
+*
+* When the producer gives less frames than a block, the spike train ends after them.
+*/
+
+static void spikeFramesRefill(SpikeFramesSource* frames, int first)
+{
+    if (first >= frames->frameCount) {
+        return;
+    }
+    int count = frames->refill(frames->producer, (void*)spikeFrameAt(frames, first), frames->blockFrames);
+    if (count < frames->blockFrames) {
+        frames->frameCount = first + count;
+    }
+}
+
+
+/**
+* @brief Next frame of a frames source.
+*
+* Without the double buffer the frame is read in place in L2. With it, the transfer of the frame t
+was started by the previous call, so we wait for it, and we start the transfer of the frame t+1
+in the other buffer while the cluster simulates the frame t.
+With a ring, at the first frame of a block every frame of the block before has been given
+(and transferred), so that block is refilled with the frames after the current block.
+*/
+
+static const void* spikeFramesNext(SpikeSource* source)
+{
+    SpikeFramesSource* frames = (SpikeFramesSource*)source;
+    int t = frames->t;
+    if (frames->refill != NULL && t > 0 && t % frames->blockFrames == 0) {
+        spikeFramesRefill(frames, t + frames->blockFrames);
+    }
+    if (t >= frames->frameCount) {
+        return NULL;
+    }
+    frames->t++;
+    if (frames->local[0] == NULL) {
+        return spikeFrameAt(frames, t);
+    }
+    if (t == 0) {
+        frames->copy.ext = (uintptr_t)spikeFrameAt(frames, 0);
+        frames->copy.loc = (uintptr_t)frames->local[0];
+        pi_cl_dma_memcpy(&frames->copy);
+    }
+    pi_cl_dma_wait(&frames->copy);
+    if (t + 1 < frames->frameCount) {
+        frames->copy.ext = (uintptr_t)spikeFrameAt(frames, t + 1);
+        frames->copy.loc = (uintptr_t)frames->local[(t + 1) & 1];
+        pi_cl_dma_memcpy(&frames->copy);
+    }
+    return frames->local[t & 1];
+}
+
+
+static void spikeFramesClose(SpikeSource* source)
+{
+    SpikeFramesSource* frames = (SpikeFramesSource*)source;
+    pi_l2_free((void*)frames->frames, frames->slots * source->frameBytes);
+    if (frames->local[0] != NULL) {
+        pi_l1_free(frames->cluster, frames->local[0], 2 * source->frameBytes);
+    }
+    if (frames->release != NULL) {
+        frames->release(frames->producer);
+    }
+}
+
+
+/**
+* @brief Allocation in L2 of slots frames of a frames source.
+*/
+
+static int spikeFramesAlloc(SpikeFramesSource* frames, int inputs, int slots, int packed)
+{
+    memset(frames, 0, sizeof(*frames));
+    frames->source.next = spikeFramesNext;
+    frames->source.close = spikeFramesClose;
+    frames->source.inputs = inputs;
+    frames->source.packed = packed;
+    frames->source.frameBytes = spikeFrameBytes(inputs, packed);
+    frames->slots = slots;
+    frames->frames = (const uint8_t*)pi_l2_malloc(slots * frames->source.frameBytes);
+    return frames->frames == NULL ? -1 : 0;
+}
+
+
+void spikeTableProducer(SpikeTableProducer* table, const int* spikes, int inputs, int timesteps, int packed)
+{
+    table->table = spikes;
+    table->inputs = inputs;
+    table->timesteps = timesteps;
+    table->packed = packed;
+    table->t = 0;
+}
+
+
+int spikeTableRefill(void* producer, void* frames, int count)
+{
+    SpikeTableProducer* table = (SpikeTableProducer*)producer;
+    size_t frameBytes = spikeFrameBytes(table->inputs, table->packed);
+    int written = 0;
+    //Every column of the table becomes a frame
+    for (; written < count && table->t < table->timesteps; written++, table->t++) {
+        void* frame = (uint8_t*)frames + written * frameBytes;
+        memset(frame, 0, frameBytes);
+        for (int i = 0; i < table->inputs; i++) {
+            int spike = table->table[i * table->timesteps + table->t] == 1;
+            if (table->packed) {
+                ((spike_word_t*)frame)[i / spikeWordBits] |= (spike_word_t)spike << (i % spikeWordBits);
+            } else {
+                ((int*)frame)[i] = spike;
+            }
+        }
+    }
+    return written;
+}
+
+
+int spikeFramesFromTable(SpikeFramesSource* frames, const int* table, int inputs, int timesteps, int packed)
+{
+    SpikeTableProducer producer;
+    if (spikeFramesAlloc(frames, inputs, timesteps, packed)) {
+        return -1;
+    }
+    spikeTableProducer(&producer, table, inputs, timesteps, packed);
+    frames->frameCount = spikeTableRefill(&producer, (void*)frames->frames, timesteps);
+    return 0;
+}
+
+
+int spikeFramesRing(SpikeFramesSource* frames, SpikeRefill refill, void* producer, int inputs, int blockFrames, int packed)
+{
+    if (spikeFramesAlloc(frames, inputs, 2 * blockFrames, packed)) {
+        return -1;
+    }
+    frames->refill = refill;
+    frames->producer = producer;
+    frames->blockFrames = blockFrames;
+    frames->frameCount = INT_MAX;
+    spikeFramesRefill(frames, 0);
+    spikeFramesRefill(frames, blockFrames);
+    return 0;
+}
+
+
+int spikeFramesPrefetch(SpikeFramesSource* frames, struct pi_device* cluster)
+{
+    size_t bytes = frames->source.frameBytes;
+    frames->local[0] = (uint8_t*)pi_l1_malloc(cluster, 2 * bytes);
+    if (frames->local[0] == NULL) {
+        return -1;
+    }
+    frames->local[1] = frames->local[0] + bytes;
+    frames->cluster = cluster;
+    frames->copy.size = bytes;
+    frames->copy.dir = PI_CL_DMA_DIR_EXT2LOC;
+    frames->copy.merge = 0;
+    return 0;
+}
+
+
+#if SPIKE_FLASH_SOURCE
+int spikeFlashOpen(SpikeFlashProducer* flash, const char* path, int inputs, int blockFrames, int packed)
+{
+    struct pi_hyperflash_conf flashConf;
+    struct pi_readfs_conf fsConf;
+    memset(flash, 0, sizeof(*flash));
+    flash->inputs = inputs;
+    flash->packed = packed;
+    flash->blockFrames = blockFrames;
+    pi_hyperflash_conf_init(&flashConf);
+    pi_open_from_conf(&spikeFlash, &flashConf);
+    if (pi_flash_open(&spikeFlash)) {
+        printf("Spikes: flash open failed\n");
+        return -1;
+    }
+    pi_readfs_conf_init(&fsConf);
+    fsConf.fs.flash = &spikeFlash;
+    pi_open_from_conf(&spikeFs, &fsConf);
+    if (pi_fs_mount(&spikeFs)) {
+        printf("Spikes: filesystem mount failed\n");
+        pi_flash_close(&spikeFlash);
+        return -1;
+    }
+    flash->file = pi_fs_open(&spikeFs, path, 0);
+    //The packed frames are converted from a buffer of a block, in L2 like the ring
+    flash->words = packed ? NULL : (spike_word_t*)pi_l2_malloc(blockFrames * spikeWords(inputs) * sizeof(spike_word_t));
+    if (flash->file == NULL || (!packed && flash->words == NULL)) {
+        printf("Spikes: cannot open %s\n", path);
+        spikeFlashClose(flash);
+        return -1;
+    }
+    return 0;
+}
+
+
+int spikeFlashRefill(void* producer, void* frames, int count)
+{
+    SpikeFlashProducer* flash = (SpikeFlashProducer*)producer;
+    size_t words = spikeWords(flash->inputs);
+    void* buffer = flash->packed ? frames : (void*)flash->words;
+    int read;
+    //The cluster reads the filesystem through the fabric controller
+    if (pi_is_fc()) {
+        read = pi_fs_read((pi_fs_file_t*)flash->file, buffer, count * words * sizeof(spike_word_t));
+    } else {
+        pi_cl_fs_req_t request;
+        pi_cl_fs_read((pi_fs_file_t*)flash->file, buffer, count * words * sizeof(spike_word_t), &request);
+        read = pi_cl_fs_wait(&request);
+    }
+    int written = read > 0 ? read / (int)(words * sizeof(spike_word_t)) : 0;
+    if (!flash->packed) {
+        for (int f = 0; f < written; f++) {
+            for (int i = 0; i < flash->inputs; i++) {
+                ((int*)frames)[f * flash->inputs + i] = spikeTest(flash->words + f * words, i);
+            }
+        }
+    }
+    return written;
+}
+
+
+void spikeFlashClose(void* producer)
+{
+    SpikeFlashProducer* flash = (SpikeFlashProducer*)producer;
+    if (flash->words != NULL) {
+        pi_l2_free(flash->words, flash->blockFrames * spikeWords(flash->inputs) * sizeof(spike_word_t));
+        flash->words = NULL;
+    }
+    if (flash->file != NULL) {
+        pi_fs_close((pi_fs_file_t*)flash->file);
+        flash->file = NULL;
+    }
+    pi_fs_unmount(&spikeFs);
+    pi_flash_close(&spikeFlash);
+}
+#endif
+
+
+#if SPIKE_FILE_SOURCE
+/**
+* @brief Next frame of a file source.
+*
+* The packed frame is read from the file and stored, packed or one int for every input,
+in the buffer that is not used by the frame given before.
+*/
+
+static const void* spikeFileNext(SpikeSource* source)
+{
+    SpikeFileSource* file = (SpikeFileSource*)source;
+    int words = spikeWords(source->inputs);
+    if (file->ended || fread(file->words, sizeof(spike_word_t), words, (FILE*)file->file) != (size_t)words) {
+        file->ended = 1;
+        return NULL;
+    }
+    uint8_t* frame = file->buffer[file->back];
+    file->back ^= 1;
+    if (source->packed) {
+        memcpy(frame, file->words, source->frameBytes);
+    } else {
+        for (int i = 0; i < source->inputs; i++) {
+            ((int*)frame)[i] = spikeTest(file->words, i);
+        }
+    }
+    return frame;
+}
+
+
+static void spikeFileClose(SpikeSource* source)
+{
+    SpikeFileSource* file = (SpikeFileSource*)source;
+    fclose((FILE*)file->file);
+    free(file->buffer[0]);
+    free(file->words);
+}
+
+
+int spikeFileOpen(SpikeFileSource* file, const char* path, int inputs, int packed)
+{
+    memset(file, 0, sizeof(*file));
+    file->source.next = spikeFileNext;
+    file->source.close = spikeFileClose;
+    file->source.inputs = inputs;
+    file->source.packed = packed;
+    file->source.frameBytes = spikeFrameBytes(inputs, packed);
+    file->file = fopen(path, "rb");
+    if (file->file == NULL) {
+        printf("Spikes: cannot open %s\n", path);
+        return -1;
+    }
+    file->buffer[0] = (uint8_t*)malloc(2 * file->source.frameBytes);
+    file->words = (spike_word_t*)malloc(spikeWords(inputs) * sizeof(spike_word_t));
+    if (file->buffer[0] == NULL || file->words == NULL) {
+        spikeFileClose(&file->source);
+        return -1;
+    }
+    file->buffer[1] = file->buffer[0] + file->source.frameBytes;
+    return 0;
+}
+#endif
@@ -0,0 +1,235 @@
+/**
+ * @file spikeSource.h
+ * @brief Streaming sources of the primary input spikes of a network.
+ *
+ * A source gives the spikes of the primary inputs one timestep (one frame) at a time, and the
+ * first layer reads the frame in place: the engine only swaps the input pointer of the layer,
+ * so the spike train can be arbitrarily long while the memory stays constant.
+ * A frame is in the format of the engine, one int (0 or 1) for every input, or bit-packed words
+ * (see spikeVector.h) when the source is opened with packed = 1.
+ *
+ * Sources:
+ * - frames in L2, double-buffered into L1 with the cluster DMA: the frame t+1 is transferred
+ *   while the cluster simulates the frame t. The frames are a whole spike train, or a ring of two
+ *   blocks refilled one block at a time by a producer, such as a file of the flash filesystem on target,
+ *   so the L2 taken doesn't depend on the length of the train;
+ * - a file of packed frames, on host, read in a double buffer, so the frame given to the
+ *   engine stays valid while the next one is read.
+ *
+ * A file of spikes is a sequence of frames, each one made of spikeWords(inputs) little-endian
+ * 32 bit words, where the bit i%32 of the word i/32 is the spike of the input i.
+ */
+
+#ifndef SPIKE_SOURCE_H
+#define SPIKE_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pmsis.h"
+#include "spikeVector.h"
+
+// If 1, the producer reading a file of the flash filesystem is available (target only)
+#ifndef SPIKE_FLASH_SOURCE
+#if defined(__riscv) || defined(__pulp__)
+#define SPIKE_FLASH_SOURCE 1
+#else
+#define SPIKE_FLASH_SOURCE 0
+#endif
+#endif
+
+// Frames of a block of a ring source
+#ifndef SPIKE_RING_BLOCK
+#define SPIKE_RING_BLOCK 16
+#endif
+
+// If 1, the file source is available (host only)
+#ifndef SPIKE_FILE_SOURCE
+#if defined(__riscv) || defined(__pulp__)
+#define SPIKE_FILE_SOURCE 0
+#else
+#define SPIKE_FILE_SOURCE 1
+#endif
+#endif
+
+typedef struct SpikeSource SpikeSource;
+
+struct SpikeSource {
+    const void* (*next)(SpikeSource* source);   // Next frame, NULL at the end of the spike train
+    void (*close)(SpikeSource* source);         // Release of the buffers of the source
+    int inputs;         // Number of primary inputs
+    int packed;         // If 1, frames are bit-packed words, otherwise one int for every input
+    size_t frameBytes;  // Size of a frame
+};
+
+/**
+ * @brief Producer of the frames of a ring source.
+ *
+ * It writes the next frames of the spike train, at most count, in the format of the source.
+ *
+ * @return The number of frames written, less than count only at the end of the spike train
+ */
+typedef int (*SpikeRefill)(void* producer, void* frames, int count);
+
+/* Frames stored in L2, for example a recorded spike train. With a local double buffer, each frame
+is copied in L1 by the cluster DMA one timestep in advance, otherwise it is read directly in L2.
+With a producer the frames are a ring of two blocks of blockFrames: at the first frame of a block,
+the block before is refilled with the frames that follow the current block. */
+typedef struct {
+    SpikeSource source;
+    const uint8_t* frames;  // The frames, one after the other
+    int frameCount;         // Number of frames, INT_MAX until the producer reaches the end
+    int t;                  // Next frame to give
+    int slots;              // Frames allocated in L2
+    SpikeRefill refill;     // Producer of the ring, or NULL
+    void* producer;         // Argument of refill
+    int blockFrames;        // Frames of a block of the ring
+    void (*release)(void* producer);    // Release of the producer when the source is closed, or NULL
+    uint8_t* local[2];      // Double buffer in L1, or NULL
+    struct pi_device* cluster;  // Cluster of the double buffer
+    pi_cl_dma_copy_t copy;  // Transfer of the next frame in the double buffer
+} SpikeFramesSource;
+
+/* Producer of the frames of a spike table, one column of the table for every frame. */
+typedef struct {
+    const int* table;       // Spikes of the inputs, table[input * timesteps + t]
+    int inputs;
+    int timesteps;
+    int packed;
+    int t;                  // Next column to convert
+} SpikeTableProducer;
+
+#if SPIKE_FLASH_SOURCE
+/* Producer reading a file of packed frames from the flash filesystem, a block of frames at a time. */
+typedef struct {
+    void* file;             // The open pi_fs_file_t
+    spike_word_t* words;    // Packed frames read from the file, for the frames of one int for every input
+    int inputs;
+    int packed;
+    int blockFrames;        // Frames of the buffer of words
+} SpikeFlashProducer;
+#endif
+
+#if SPIKE_FILE_SOURCE
+/* File of packed frames, on host: every frame is read in the buffer not used by the previous one. */
+typedef struct {
+    SpikeSource source;
+    void* file;             // The open FILE
+    uint8_t* buffer[2];     // Double buffer of frames
+    spike_word_t* words;    // Packed frame read from the file
+    int back;               // Buffer that receives the next frame
+    int ended;              // 1 when the file has no more frames
+} SpikeFileSource;
+#endif
+
+/**
+ * @brief Size of a frame of a source.
+ */
+#define spikeFrameBytes(inputs, packed) \
+    ((packed) ? (size_t)spikeWords(inputs) * sizeof(spike_word_t) : (size_t)(inputs) * sizeof(int))
+
+/**
+ * @brief Next frame of a source, NULL at the end of the spike train.
+ */
+static inline const void* spikeSourceNext(SpikeSource* source)
+{
+    return source->next(source);
+}
+
+/**
+ * @brief Frames source over a spike table.
+ *
+ * The table has one row of timesteps spikes for every input, like the input table of parallelLIF.c,
+ * and it is converted once in frames allocated in L2.
+ *
+ * @param frames The source to initialize
+ * @param table Spikes of the inputs, table[input * timesteps + t]
+ * @param inputs Number of inputs
+ * @param timesteps Number of timesteps of the table
+ * @param packed Format of the frames
+ * @return 0 on success, -1 if the frames cannot be allocated
+ */
+int spikeFramesFromTable(SpikeFramesSource* frames, const int* table, int inputs, int timesteps, int packed);
+
+/**
+ * @brief Frames source over a ring of two blocks in L2, refilled by a producer.
+ *
+ * Both blocks are filled here; after that, the producer is called by next(), on the cluster when the
+ * source is prefetched.
+ *
+ * @param frames The source to initialize
+ * @param refill The producer
+ * @param producer Argument of refill
+ * @param inputs Number of inputs
+ * @param blockFrames Frames of a block
+ * @param packed Format of the frames
+ * @return 0 on success, -1 if the ring cannot be allocated
+ */
+int spikeFramesRing(SpikeFramesSource* frames, SpikeRefill refill, void* producer, int inputs, int blockFrames, int packed);
+
+/**
+ * @brief Producer of a ring source over a spike table.
+ *
+ * @param table The producer to initialize
+ * @param spikes Spikes of the inputs, spikes[input * timesteps + t]
+ * @param inputs Number of inputs
+ * @param timesteps Number of timesteps of the table
+ * @param packed Format of the frames
+ */
+void spikeTableProducer(SpikeTableProducer* table, const int* spikes, int inputs, int timesteps, int packed);
+
+/**
+ * @brief Refill of a ring source from a SpikeTableProducer.
+ */
+int spikeTableRefill(void* producer, void* frames, int count);
+
+#if SPIKE_FLASH_SOURCE
+/**
+ * @brief Opening of a file of spikes of the flash filesystem, on target.
+ *
+ * The filesystem is mounted here, from the fabric controller.
+ *
+ * @param flash The producer to initialize
+ * @param path Name of the file
+ * @param inputs Number of inputs
+ * @param blockFrames Frames of a block of the ring it will fill
+ * @param packed Format of the frames
+ * @return 0 on success, -1 if the file cannot be opened
+ */
+int spikeFlashOpen(SpikeFlashProducer* flash, const char* path, int inputs, int blockFrames, int packed);
+
+/**
+ * @brief Refill of a ring source from a SpikeFlashProducer, from the fabric controller or the cluster.
+ */
+int spikeFlashRefill(void* producer, void* frames, int count);
+
+/**
+ * @brief Closing of the file and of the filesystem of a SpikeFlashProducer, the release of its ring.
+ */
+void spikeFlashClose(void* producer);
+#endif
+
+/**
+ * @brief Double buffer in L1 of a frames source.
+ *
+ * After this call, next() must be called by a cluster core, because it uses the cluster DMA.
+ *
+ * @param frames The source
+ * @param cluster The cluster device, used for the L1 allocation
+ * @return 0 on success, -1 if L1 is full
+ */
+int spikeFramesPrefetch(SpikeFramesSource* frames, struct pi_device* cluster);
+
+/**
+ * @brief Opening of a file of spikes, on host.
+ *
+ * @param file The source to initialize
+ * @param path Path of the file
+ * @param inputs Number of inputs
+ * @param packed Format of the frames
+ * @return 0 on success, -1 if the file cannot be opened
+ */
+#if SPIKE_FILE_SOURCE
+int spikeFileOpen(SpikeFileSource* file, const char* path, int inputs, int packed);
+#endif
+
+#endif // SPIKE_SOURCE_H
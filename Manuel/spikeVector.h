@@ -0,0 +1,96 @@
+/**
+ * @file spikeVector.h
+ * @brief Bit-packed spike vectors: 32 neurons per word, one bit per spike.
+ *
+ * A spike is a binary event, so a layer output of n neurons is stored in spikeWords(n) words
+ * instead of n int. The active neurons are visited with find-first-set (p.ff1 on GAP8,
+ * bsf/tzcnt on host), so a loop over the spikes costs O(active spikes) and not O(neurons).
+ */
+
+#ifndef SPIKE_VECTOR_H
+#define SPIKE_VECTOR_H
+
+#include <stdint.h>
+
+typedef uint32_t spike_word_t;
+
+/**
+ * @brief Number of spikes stored in a word.
+ */
+#define spikeWordBits 32
+
+/**
+ * @brief Number of words needed to store the spikes of n neurons.
+ */
+#define spikeWords(n) (((n) + spikeWordBits - 1) / spikeWordBits)
+
+/**
+ * @brief Index of the least significant set bit of a non zero word.
+ */
+#if defined(__pulp__)
+#define spikeFirst(word) __builtin_pulp_ff1(word)
+#else
+#define spikeFirst(word) __builtin_ctz(word)
+#endif
+
+/**
+ * @brief Number of set bits of a word.
+ */
+#define spikeCount(word) __builtin_popcount(word)
+
+/**
+ * @brief Value of the spike of a neuron.
+ */
+static inline int spikeTest(const spike_word_t* spikes, int neuron)
+{
+    return (spikes[neuron / spikeWordBits] >> (neuron % spikeWordBits)) & 1;
+}
+
+/**
+ * @brief Sum of the weights of the active inputs of a neuron.
+ *
+ * Only the set bits are visited: every iteration takes the lowest spike of the word and clears it.
+ *
+ * @param spikes Bit-packed input spikes
+ * @param words Number of words of the input
+ * @param weights Weights of the neuron, one for every input
+ * @return The synaptic current of the neuron
+ */
+static inline int spikeAccumulate(const spike_word_t* spikes, int words, const int* weights)
+{
+    int current = 0;
+    for (int w = 0; w < words; w++) {
+        spike_word_t word = spikes[w];
+        const int* column = weights + w * spikeWordBits;
+        while (word) {
+            current += column[spikeFirst(word)];
+            word &= word - 1;
+        }
+    }
+    return current;
+}
+
+/**
+ * @brief Packing of spike flags into words.
+ *
+ * The flags [begin,end) are stored in the words that contain them; begin must be a multiple
+ * of spikeWordBits, so the caller owns every word it writes and no other core touches them.
+ *
+ * @param spikes Bit-packed destination
+ * @param flags Spike flags, 0 or 1
+ * @param begin First flag, multiple of spikeWordBits
+ * @param end Flag after the last one
+ */
+static inline void spikePack(spike_word_t* spikes, const int* flags, int begin, int end)
+{
+    for (int w = begin; w < end; w += spikeWordBits) {
+        spike_word_t word = 0;
+        int last = w + spikeWordBits < end ? w + spikeWordBits : end;
+        for (int i = w; i < last; i++) {
+            word |= (spike_word_t)flags[i] << (i - w);
+        }
+        spikes[w / spikeWordBits] = word;
+    }
+}
+
+#endif // SPIKE_VECTOR_H
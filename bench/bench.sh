@@ -0,0 +1,69 @@
+#!/bin/sh
+# Sweep of the SNN engines over layer widths, depths, input spike rates and core counts.
+#
+# For every point of the grid, the network is width primary inputs followed by depth fully connected
+# layers of width neurons (the Izhikevich network has always 2 layers), the inputs are random spikes
+# at the given rate, and the engine runs STEPS timesteps on the given number of emulated cores.
+# One CSV row per run is written on stdout; the time is the simulation loop only, without the
+# instanziation.
+#
+# Run it from bench/ after make, or with make run.
+
+WIDTHS=${WIDTHS:-"10 64 256 1024 4096"}
+DEPTHS=${DEPTHS:-"1 3"}
+RATES=${RATES:-"0.01 0.05 0.2"}
+THREADS=${THREADS:-"1 2 4 8"}
+STEPS=${STEPS:-100}
+ENGINES=${ENGINES:-"lif lif-event lif-pipeline izhikevich"}
+SEED=${SEED:-1}
+
+BUILD=build
+WORK=$(mktemp -d "${TMPDIR:-/tmp}/snnbench.XXXXXX") || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+echo "engine,width,depth,rate,threads,timesteps,ns,ns_per_timestep,neuron_updates_per_s,synaptic_events_per_s"
+
+# run <engine> <width> <depth> <rate> <threads> <binary>: one run, one row
+run() {
+    line=$(PMSIS_HOST_NB_CORES=$5 SNN_MODEL=$WORK/model.snn SNN_INPUT=$WORK/spikes.bin "$6" | grep '^bench ')
+    if [ -z "$line" ]; then
+        echo "$1 width $2 depth $3 rate $4 threads $5: no report" >&2
+        return
+    fi
+    echo "$line" | awk -v engine="$1" -v width="$2" -v depth="$3" -v rate="$4" -v threads="$5" '{
+        for (i = 2; i <= NF; i++) { split($i, kv, "="); v[kv[1]] = kv[2] }
+        ns = v["ns"] > 0 ? v["ns"] : 1
+        printf "%s,%d,%d,%s,%d,%d,%.0f,%.1f,%.0f,%.0f\n", engine, width, depth, rate, threads, v["timesteps"], v["ns"],
+               ns / (v["timesteps"] > 0 ? v["timesteps"] : 1), v["neuron_updates"] * 1e9 / ns, v["synaptic_events"] * 1e9 / ns
+    }'
+}
+
+for width in $WIDTHS; do
+    for rate in $RATES; do
+        "$BUILD/spikeGen" "$WORK/spikes.bin" "$width" "$STEPS" "$rate" "$SEED" || exit 1
+        for engine in $ENGINES; do
+            case $engine in
+            izhikevich)
+                make -s "$BUILD/izhikevich-$width" >&2 || exit 1
+                for threads in $THREADS; do
+                    run "$engine" "$width" 2 "$rate" "$threads" "$BUILD/izhikevich-$width"
+                done
+                ;;
+            *)
+                for depth in $DEPTHS; do
+                    layers=""
+                    for l in $(seq "$depth"); do
+                        layers="$layers $width"
+                    done
+                    weights=""
+                    [ "$engine" = lif-int8 ] && weights=-w8
+                    "$BUILD/modelExport" $weights "$WORK/model.snn" "$width" $layers > /dev/null || exit 1
+                    for threads in $THREADS; do
+                        run "$engine" "$width" "$depth" "$rate" "$threads" "$BUILD/$engine"
+                    done
+                done
+                ;;
+            esac
+        done
+    done
+done
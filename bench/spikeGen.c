@@ -0,0 +1,74 @@
+/**
+ * @file spikeGen.c
+ * @brief Host tool writing a file of random input spikes (see Manuel/spikeSource.h).
+ *
+ * Every input spikes at every timestep with the given probability, independently of the others,
+ * so the rate sets the sparsity of the primary inputs. The seed makes the runs of a sweep comparable.
+ *
+ *     gcc -O2 -IManuel bench/spikeGen.c -o spikeGen
+ *     ./spikeGen spikes.bin inputs timesteps rate [seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "spikeVector.h"
+
+/** @brief xorshift64 generator, the same stream on every platform. */
+static uint64_t genNext(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 5) {
+        printf("usage: %s spikes.bin inputs timesteps rate [seed]\n", argv[0]);
+        return 1;
+    }
+    int inputs = atoi(argv[2]);
+    long timesteps = atol(argv[3]);
+    double rate = atof(argv[4]);
+    uint64_t state = argc > 5 ? strtoull(argv[5], NULL, 0) : 1;
+    if (inputs <= 0 || timesteps <= 0 || rate < 0.0 || rate > 1.0) {
+        printf("The inputs and the timesteps must be positive, the rate between 0 and 1\n");
+        return 1;
+    }
+    state = state ? state : 1;
+    // A spike when the 53 high bits, as a fraction of 1, are below the rate
+    uint64_t limit = (uint64_t)(rate * (double)(1ull << 53));
+
+    FILE* file = fopen(argv[1], "wb");
+    if (file == NULL) {
+        printf("Cannot create %s\n", argv[1]);
+        return 1;
+    }
+    int words = spikeWords(inputs);
+    uint8_t* frame = malloc(words * sizeof(spike_word_t));
+    for (long t = 0; t < timesteps; t++) {
+        for (int w = 0; w < words; w++) {
+            spike_word_t word = 0;
+            for (int b = 0; b < spikeWordBits && w * spikeWordBits + b < inputs; b++) {
+                if ((genNext(&state) >> 11) < limit) {
+                    word |= (spike_word_t)1 << b;
+                }
+            }
+            // Little-endian on every host
+            for (int byte = 0; byte < 4; byte++) {
+                frame[w * 4 + byte] = (uint8_t)(word >> (8 * byte));
+            }
+        }
+        fwrite(frame, sizeof(spike_word_t), words, file);
+    }
+    free(frame);
+    if (fclose(file) != 0) {
+        printf("Cannot write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}